@@ -0,0 +1,123 @@
+// Checks the YUV420P to BGR24 converters against swscale and measures their
+// throughput.
+// Usage: converter_bench [width height iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "h264decoder.hpp"
+
+namespace {
+
+// Largest per channel difference allowed between a kernel and swscale
+constexpr int tolerance = 3;
+
+struct Plane {
+  std::vector<unsigned char> data;
+  int linesize;
+};
+
+// Smooth chroma, as in camera images, so that differences in chroma
+// upsampling between swscale and the kernels stay small, with noisy luma
+void fillFrame(AVFrame* frame, Plane planes[3], int w, int h)
+{
+  std::mt19937 rng(42);
+  const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+  // Padded strides, as output by the decoder
+  planes[0] = {std::vector<unsigned char>((w + 32) * h), w + 32};
+  planes[1] = {std::vector<unsigned char>((cw + 16) * ch), cw + 16};
+  planes[2] = {std::vector<unsigned char>((cw + 16) * ch), cw + 16};
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x)
+      planes[0].data[y * planes[0].linesize + x] = 16 + (x * 219 / w + rng() % 32) % 220;
+  for (int y = 0; y < ch; ++y)
+    for (int x = 0; x < cw; ++x) {
+      planes[1].data[y * planes[1].linesize + x] = 16 + x * 224 / cw;
+      planes[2].data[y * planes[2].linesize + x] = 240 - y * 224 / ch;
+    }
+  for (int i = 0; i < 3; ++i) {
+    frame->data[i] = planes[i].data.data();
+    frame->linesize[i] = planes[i].linesize;
+  }
+  frame->width = w;
+  frame->height = h;
+  frame->format = AV_PIX_FMT_YUV420P;
+}
+
+double millisecondsPerFrame(ConverterRGB24& converter, const AVFrame& frame,
+  std::vector<unsigned char>& out, int iterations)
+{
+  converter.convert(frame, out.data()); // warm up
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    converter.convert(frame, out.data());
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  const int w = argc > 2 ? std::atoi(argv[1]) : 960;
+  const int h = argc > 2 ? std::atoi(argv[2]) : 720;
+  const int iterations = argc > 3 ? std::atoi(argv[3]) : 500;
+
+  AVFrame* frame = av_frame_alloc();
+  Plane planes[3];
+  fillFrame(frame, planes, w, h);
+
+  ConverterRGB24 reference(ConverterBackend::Swscale);
+  std::vector<unsigned char> expected(reference.predict_size(w, h));
+  std::vector<unsigned char> out(expected.size());
+  std::vector<unsigned char> scalar(expected.size());
+  reference.convert(*frame, expected.data());
+
+  bool ok = true;
+  std::printf("%dx%d, %d iterations\n", w, h, iterations);
+  std::printf("%-8s %10s %10s %9s %9s\n", "backend", "ms/frame", "frames/s", "max diff", "mean diff");
+
+  const ConverterBackend backends[] = {ConverterBackend::Swscale, ConverterBackend::Scalar,
+    ConverterBackend::SSE4, ConverterBackend::AVX2};
+  for (ConverterBackend requested : backends) {
+    ConverterRGB24 converter(requested);
+    if (converter.get_backend() != requested) {
+      std::printf("%-8s not supported by this CPU\n", ConverterRGB24::backend_name(requested));
+      continue;
+    }
+    const double ms = millisecondsPerFrame(converter, *frame, out, iterations);
+
+    int max_diff = 0;
+    double sum_diff = 0;
+    for (size_t i = 0; i < out.size(); ++i) {
+      const int d = std::abs(static_cast<int>(out[i]) - static_cast<int>(expected[i]));
+      max_diff = d > max_diff ? d : max_diff;
+      sum_diff += d;
+    }
+    std::printf("%-8s %10.3f %10.1f %9d %9.3f\n", ConverterRGB24::backend_name(requested),
+      ms, 1000.0 / ms, max_diff, sum_diff / out.size());
+
+    if (max_diff > tolerance) {
+      std::printf("  FAIL: differs from swscale by more than %d\n", tolerance);
+      ok = false;
+    }
+    // The vectorised kernels have to be bit exact with the scalar one
+    if (requested == ConverterBackend::Scalar) {
+      scalar = out;
+    }
+    else if (requested != ConverterBackend::Swscale && out != scalar) {
+      std::printf("  FAIL: differs from the scalar kernel\n");
+      ok = false;
+    }
+  }
+
+  av_frame_free(&frame);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
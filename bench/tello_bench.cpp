@@ -0,0 +1,336 @@
+// Benchmarks the stages of the video hot path, H264Decoder::parse, decoding
+// (send_packet/receive_frame) and the YUV to BGR conversion, over a recorded
+// H.264 stream.
+// Usage: TELLO_BENCH_STREAM=<file> tello_bench [google benchmark flags]
+// The stream is either a raw Annex-B elementary stream (eg .h264) or a
+// capture file written with the capture_file option, of which the video
+// datagrams are used.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include "h264decoder.hpp"
+#include "stream_capture.hpp"
+
+// Counts heap allocations, including those made by FFmpeg, by wrapping the
+// glibc allocator
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+static std::atomic<size_t> n_allocations{0};
+
+void* malloc(size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr != nullptr || size == 0 ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+}
+
+static size_t allocations()
+{
+  return n_allocations.load(std::memory_order_relaxed);
+}
+#else
+static size_t allocations()
+{
+  return 0;
+}
+#endif
+
+namespace {
+
+// Decoded frames kept for the conversion benchmark
+constexpr size_t max_frames = 64;
+
+struct Stream {
+  std::vector<unsigned char> data;
+  std::vector<AVFrame*> frames;
+  std::string error;
+};
+
+std::vector<unsigned char> readStream(const char* file_name, std::string& error)
+{
+  CaptureReader capture(file_name);
+  if (capture.isOpen()) {
+    std::vector<unsigned char> data;
+    CaptureRecord record;
+    while (capture.next(record)) {
+      if (record.stream == CaptureStream::Video)
+        data.insert(data.end(), record.payload.begin(), record.payload.end());
+    }
+    return data;
+  }
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file.is_open()) {
+    error = std::string("cannot open ") + file_name;
+    return {};
+  }
+  return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), {});
+}
+
+// Calls f for every frame decoded from data; returns the number of frames
+template <typename F>
+size_t decodeAll(H264Decoder& decoder, const std::vector<unsigned char>& data, F f)
+{
+  size_t n_frames = 0;
+  size_t next = 0;
+  while (next < data.size()) {
+    ssize_t consumed = decoder.parse(data.data() + next, data.size() - next);
+    if (decoder.is_frame_available()) {
+      bool sent = decoder.send_packet();
+      while (const AVFrame* frame = decoder.receive_frame()) {
+        f(*frame);
+        n_frames++;
+      }
+      if (!sent && decoder.send_packet()) {
+        while (const AVFrame* frame = decoder.receive_frame()) {
+          f(*frame);
+          n_frames++;
+        }
+      }
+    }
+    next += consumed;
+  }
+  return n_frames;
+}
+
+// Loaded once; the benchmarks are skipped if no stream is given
+const Stream& stream()
+{
+  static Stream s = [] {
+    Stream s;
+    const char* file_name = std::getenv("TELLO_BENCH_STREAM");
+    if (file_name == nullptr) {
+      s.error = "set TELLO_BENCH_STREAM to an H.264 stream or a capture file";
+      return s;
+    }
+    s.data = readStream(file_name, s.error);
+    if (s.data.empty()) {
+      if (s.error.empty())
+        s.error = std::string("no video in ") + file_name;
+      return s;
+    }
+    try {
+      H264Decoder decoder;
+      decodeAll(decoder, s.data, [&s](const AVFrame& frame) {
+        if (s.frames.size() < max_frames)
+          s.frames.push_back(av_frame_clone(&frame));
+      });
+    }
+    catch (const H264Exception& e) {
+      s.error = std::string("cannot decode the stream: ") + e.what();
+    }
+    if (s.error.empty() && s.frames.empty())
+      s.error = "the stream holds no decodable frame";
+    return s;
+  }();
+  return s;
+}
+
+void setCounters(benchmark::State& state, size_t n_frames, size_t n_allocations)
+{
+  state.counters["frames/s"] = benchmark::Counter(static_cast<double>(n_frames), benchmark::Counter::kIsRate);
+  state.counters["ns/frame"] = benchmark::Counter(static_cast<double>(n_frames) * 1e-9,
+    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  state.counters["allocs/frame"] = n_frames > 0 ? static_cast<double>(n_allocations) / n_frames : 0;
+}
+
+void BM_Parse(benchmark::State& state)
+{
+  const Stream& s = stream();
+  if (!s.error.empty()) {
+    state.SkipWithError(s.error.c_str());
+    return;
+  }
+  H264Decoder decoder;
+  size_t n_packets = 0;
+  const size_t allocations_before = allocations();
+  for (auto _ : state) {
+    size_t next = 0;
+    while (next < s.data.size()) {
+      next += decoder.parse(s.data.data() + next, s.data.size() - next);
+      if (decoder.is_frame_available())
+        n_packets++;
+    }
+  }
+  setCounters(state, n_packets, allocations() - allocations_before);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * s.data.size()));
+}
+
+// Times send_packet/receive_frame only; parsing is excluded with manual timing
+void BM_Decode(benchmark::State& state)
+{
+  const Stream& s = stream();
+  if (!s.error.empty()) {
+    state.SkipWithError(s.error.c_str());
+    return;
+  }
+  const H264ThreadType thread_type = state.range(1) ? H264ThreadType::Frame : H264ThreadType::Slice;
+  size_t n_frames = 0, n_allocations = 0;
+  for (auto _ : state) {
+    // A fresh decoder per pass, as the stream starts with its parameter sets
+    H264Decoder decoder(static_cast<int>(state.range(0)), thread_type);
+    std::chrono::steady_clock::duration elapsed{};
+    size_t next = 0;
+    while (next < s.data.size()) {
+      ssize_t consumed = decoder.parse(s.data.data() + next, s.data.size() - next);
+      if (decoder.is_frame_available()) {
+        const size_t allocations_before = allocations();
+        const auto start = std::chrono::steady_clock::now();
+        bool sent = decoder.send_packet();
+        while (decoder.receive_frame() != nullptr)
+          n_frames++;
+        if (!sent && decoder.send_packet()) {
+          while (decoder.receive_frame() != nullptr)
+            n_frames++;
+        }
+        elapsed += std::chrono::steady_clock::now() - start;
+        n_allocations += allocations() - allocations_before;
+      }
+      next += consumed;
+    }
+    state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+  }
+  setCounters(state, n_frames, n_allocations);
+}
+
+void BM_Convert(benchmark::State& state)
+{
+  const Stream& s = stream();
+  if (!s.error.empty()) {
+    state.SkipWithError(s.error.c_str());
+    return;
+  }
+  ConverterRGB24 converter(static_cast<ConverterBackend>(state.range(0)));
+  state.SetLabel(ConverterRGB24::backend_name(converter.get_backend()));
+  const AVFrame& first = *s.frames.front();
+  std::vector<unsigned char> out(converter.predict_size(first.width, first.height));
+
+  size_t n_frames = 0, i = 0;
+  const size_t allocations_before = allocations();
+  for (auto _ : state) {
+    const AVFrame& frame = *s.frames[i];
+    i = (i + 1) % s.frames.size();
+    out.resize(converter.predict_size(frame.width, frame.height));
+    converter.convert(frame, out.data());
+    benchmark::DoNotOptimize(out.data());
+    n_frames++;
+  }
+  setCounters(state, n_frames, allocations() - allocations_before);
+}
+
+void BM_ConvertGray(benchmark::State& state)
+{
+  const Stream& s = stream();
+  if (!s.error.empty()) {
+    state.SkipWithError(s.error.c_str());
+    return;
+  }
+  ConverterGray8 converter;
+  const AVFrame& first = *s.frames.front();
+  std::vector<unsigned char> out(converter.predict_size(first.width, first.height));
+
+  size_t n_frames = 0, i = 0;
+  const size_t allocations_before = allocations();
+  for (auto _ : state) {
+    const AVFrame& frame = *s.frames[i];
+    i = (i + 1) % s.frames.size();
+    out.resize(converter.predict_size(frame.width, frame.height));
+    converter.convert(frame, out.data());
+    benchmark::DoNotOptimize(out.data());
+    n_frames++;
+  }
+  setCounters(state, n_frames, allocations() - allocations_before);
+}
+
+void BM_ConvertScaled(benchmark::State& state)
+{
+  const Stream& s = stream();
+  if (!s.error.empty()) {
+    state.SkipWithError(s.error.c_str());
+    return;
+  }
+  // Divisor of the frame size, eg 2 for a half size preview
+  const int divisor = static_cast<int>(state.range(0));
+  const OutputFormat format = static_cast<OutputFormat>(state.range(1));
+  ConverterScaled converter;
+  std::vector<unsigned char> out;
+
+  size_t n_frames = 0, i = 0;
+  const size_t allocations_before = allocations();
+  for (auto _ : state) {
+    const AVFrame& frame = *s.frames[i];
+    i = (i + 1) % s.frames.size();
+    const int w = frame.width / divisor, h = frame.height / divisor;
+    out.resize(ConverterScaled::predict_size(w, h, format));
+    converter.convert(frame, w, h, format, out.data());
+    benchmark::DoNotOptimize(out.data());
+    n_frames++;
+  }
+  setCounters(state, n_frames, allocations() - allocations_before);
+}
+
+} // namespace
+
+BENCHMARK(BM_Parse)->Unit(benchmark::kMillisecond);
+// Decoder threads (0 for one per core), frame (1) or slice (0) threading
+BENCHMARK(BM_Decode)->Args({1, 0})->Args({0, 0})->Args({0, 1})
+  ->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Convert)
+  ->Arg(static_cast<int>(ConverterBackend::Swscale))
+  ->Arg(static_cast<int>(ConverterBackend::Scalar))
+  ->Arg(static_cast<int>(ConverterBackend::SSE4))
+  ->Arg(static_cast<int>(ConverterBackend::AVX2))
+  ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ConvertGray)->Unit(benchmark::kMicrosecond);
+// Divisor of the frame size, BGR24 (0) or GRAY8 (1)
+BENCHMARK(BM_ConvertScaled)
+  ->Args({2, static_cast<int>(OutputFormat::BGR24)})
+  ->Args({4, static_cast<int>(OutputFormat::BGR24)})
+  ->Args({2, static_cast<int>(OutputFormat::GRAY8)})
+  ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
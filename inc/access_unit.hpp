@@ -0,0 +1,23 @@
+#ifndef ACCESSUNIT_HPP
+#define ACCESSUNIT_HPP
+
+#include <chrono>
+
+#include "frame_slab.hpp"
+
+/**
+* @struct AccessUnit
+* @brief Encoded frame assembled from the datagrams sent by the drone
+*/
+struct AccessUnit{
+  /** \brief Annex-B H.264 data of the frame */
+  FrameSlab data;
+  /** \brief Time at which the first datagram of the frame was received */
+  std::chrono::steady_clock::time_point first_packet_time;
+  /** \brief Time at which the last datagram of the frame was received */
+  std::chrono::steady_clock::time_point last_packet_time;
+  /** \brief Set if frames received before this one were dropped before reaching the decoder */
+  bool follows_gap = false;
+};
+
+#endif // ACCESSUNIT_HPP
@@ -1,9 +1,13 @@
 #ifndef BASESOCKET_HPP
 #define BASESOCKET_HPP
 
+#include <atomic>
+#include <memory>
 #include <thread>
 #include "asio.hpp"
 
+#include "stream_capture.hpp"
+
 /**
 * @class BaseSocket
 * @brief Abstract class inhereted by the other socket classes
@@ -22,15 +26,67 @@ public:
 
   virtual ~BaseSocket();
 
+  /**
+  * @brief capture every datagram received from now on
+  * @param [in] capture writer the datagrams are appended to, shared by the sockets of a drone
+  * @param [in] stream id the datagrams of this socket are recorded with
+  * @return void
+  */
+  void setCapture(std::shared_ptr<CaptureWriter> capture, CaptureStream stream);
+
+  /**
+  * @brief stop receiving from the drone so that captured datagrams can be injected
+  * @return void
+  * @details Cancels the pending receive on the io_service thread and waits
+  until that is done, so it must not be called from a handler of the
+  io_service; it returns without replaying if the io_service is stopped.
+  Datagrams received from the drone afterwards are ignored, and nothing is
+  sent to the drone, so a replay should be run without a drone on the network.
+  */
+  void startReplay();
+
+  /**
+  * @brief process a datagram as if it had been received from the drone
+  * @param [in] data contents of the datagram
+  * @param [in] size size of the datagram in bytes
+  * @return void
+  * @details Only valid after startReplay(); must not be called by more than
+  one thread at a time
+  */
+  void injectDatagram(const unsigned char* data, size_t size);
+
 protected:
 
+  /**
+  * @brief append a received datagram to the capture file, if capturing
+  * @param [in] data contents of the datagram
+  * @param [in] size size of the datagram in bytes
+  * @return void
+  */
+  void capture(const void* data, size_t size);
+
   std::string local_port_, drone_ip_, drone_port_;
   asio::io_service& io_service_;
   asio::ip::udp::socket socket_;
   asio::ip::udp::endpoint endpoint_;
   std::thread io_thread;
+  /** \brief set once replay has started; receive handlers must then return without re-arming */
+  std::atomic<bool> replaying_{false};
 
 private:
+  /**
+  * @brief function called for a datagram injected by a replay
+  * @param [in] data contents of the datagram
+  * @param [in] size size of the datagram in bytes
+  * @return void
+  * @details Pure virtual function overridden in implementation classes; it
+  must handle the datagram exactly as handleResponseFromDrone would
+  */
+  virtual void processInjectedDatagram(const unsigned char* data, size_t size) = 0;
+
+  std::shared_ptr<CaptureWriter> capture_;
+  CaptureStream capture_stream_ = CaptureStream::Command;
+
   /**
   * @brief function called when response received from drone
   * @param [in] error error thrown by socket when receiving a response from drone
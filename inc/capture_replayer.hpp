@@ -0,0 +1,56 @@
+#ifndef CAPTUREREPLAYER_HPP
+#define CAPTUREREPLAYER_HPP
+
+#include <atomic>
+#include <map>
+#include <string>
+
+#include "base_socket.hpp"
+#include "stream_capture.hpp"
+
+/**
+* @class CaptureReplayer
+* @brief Feeds the datagrams of a capture file back through the sockets' receive handlers
+* @details Datagrams are injected in the order they were captured, either
+paced by their receive timestamps or as fast as the handlers take them.
+Datagrams of streams without a target socket are skipped.
+*/
+class CaptureReplayer{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] file_name path of the capture file
+  * @return none
+  */
+  explicit CaptureReplayer(const std::string& file_name);
+
+  /**
+  * @brief set the socket the datagrams of a stream are injected into
+  * @param [in] stream stream id the datagrams were captured with
+  * @param [in] socket socket that handles them
+  * @return void
+  */
+  void addTarget(CaptureStream stream, BaseSocket& socket);
+
+  /**
+  * @brief replay the file; blocks until it is done or stop() is called
+  * @param [in] speed 1 to replay in real time, 2 for twice as fast etc., 0 for as fast as possible
+  * @return size_t number of datagrams injected
+  */
+  size_t run(double speed = 1.0);
+
+  /**
+  * @brief make run() return before the end of the file
+  * @return void
+  */
+  void stop();
+
+private:
+
+  const std::string file_name_;
+  std::map<CaptureStream, BaseSocket*> targets_;
+  std::atomic<bool> on_{true};
+};
+
+#endif // CAPTUREREPLAYER_HPP
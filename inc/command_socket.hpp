@@ -1,18 +1,78 @@
 #ifndef COMMANDSOCKET_HPP
 #define COMMANDSOCKET_HPP
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <deque>
+#include <memory>
 #include <mutex>
-#include <thread>
-#include <condition_variable>
+#include <vector>
 
 #include "base_socket.hpp"
 #include "joystick.hpp"
+#include "latency_histogram.hpp"
+#include "tello_command.hpp"
+
+/**
+* @struct CommandQueueStats
+* @brief Snapshot of the counters of the command queue of a drone
+*/
+struct CommandQueueStats{
+  /** \brief Commands waiting in the execution queue */
+  size_t queue_depth = 0;
+  /** \brief Highest number of commands that waited in the execution queue */
+  size_t max_queue_depth = 0;
+  /** \brief Commands sent to the drone, retries included */
+  size_t commands_sent = 0;
+  /** \brief Timer waits not yet handled; the queue, the automatic landing guard and the rc channel have one timer each, and starting the rc channel posts one more handler, so at most four; a handler that arms its timer again counts twice until it returns */
+  size_t pending_timers = 0;
+  /** \brief Responses received while no command awaited one */
+  size_t unmatched_responses = 0;
+  /** \brief Stick setpoints given to the rc channel */
+  size_t rc_updates = 0;
+  /** \brief rc commands sent by the rc channel */
+  size_t rc_sent = 0;
+  /** \brief Stick setpoints replaced by a newer one before the rc channel sent them */
+  size_t rc_coalesced = 0;
+  /** \brief Commands sent while every preallocated send buffer was in use, which allocated one */
+  size_t send_buffer_misses = 0;
+};
+
+/**
+* @struct CommandTypeStats
+* @brief Counters and round trip times of the commands of one entry of command_table
+*/
+struct CommandTypeStats{
+  /** \brief First word of the commands, eg "forward" or "battery?"; "other" for the commands not in command_table */
+  std::string command;
+  /** \brief Commands sent, retries included */
+  size_t sent = 0;
+  /** \brief Responses received */
+  size_t responses = 0;
+  /** \brief Responses starting with "error" */
+  size_t errors = 0;
+  /** \brief Commands of the queue resent as no response arrived in time */
+  size_t retries = 0;
+  /** \brief Times a command of the queue got no response in time */
+  size_t timeouts = 0;
+  /** \brief Time from sending a command, or its last retry, to its response */
+  LatencyHistogram::Summary rtt;
+};
 
 /**
 * @class CommandSocket
 * @brief Socket class that handles the communication of commands to the tello
+* @details The commands of the execution queue are sent by a state machine
+run by the io_service: a command is sent, a timer is armed for its response,
+and the response or the timer decides whether the next command is sent or the
+command is retried. The next command goes out from the handler of the
+response, so no thread waits or polls on the command path. Keeping the drone
+from landing on its own is a timer of the same io_service; a socket starts
+no thread besides the io_service thread of every socket, however many commands
+it sends. Commands are TelloCommand values, serialized once when they are
+built; whether the queue waits for a response, may retry or sends at once is
+looked up in command_table.
 */
 class CommandSocket : public BaseSocket {
 public:
@@ -23,10 +83,11 @@ public:
   * @param [in] drone_port port number on the drone
   * @param [in] local_port port on the local machine used to communicate with the drone port mentioned above
   * @param [in] n_retries_allowed numebr of retries allowed if a response is not received from the drone before sending the next command in the execution queue
-  * @param [in] timeout number of seconds after which a command is said to have failed to be sent
+  * @param [in] timeout time after which a command without a response is said to have failed to be sent
+  * @param [in] rc_rate rate in Hz, 1 to 100, at which the rc channel sends the stick setpoint
   * @return none
   */
-  CommandSocket(asio::io_service& io_service, const std::string& drone_ip, const std::string& drone_port, const std::string& local_port, int n_retries_allowed = 1, int timeout = 7);
+  CommandSocket(asio::io_service& io_service, const std::string& drone_ip, const std::string& drone_port, const std::string& local_port, int n_retries_allowed = 1, std::chrono::milliseconds timeout = std::chrono::seconds(7), int rc_rate = 30);
 
   /**
   * @brief Starts execution of the command queue
@@ -41,6 +102,13 @@ public:
   */
   void addCommandToQueue(const std::string& cmd);
 
+  /**
+  * @brief Adds the command to the execution queue
+  * @param [in] cmd command to be added to the end of the execution queue, eg cmd::Move{MoveDirection::Forward, 20}
+  * @return void
+  */
+  void addCommandToQueue(const TelloCommand& cmd);
+
   /**
   * @brief Adds the command to the front of the execution queue
   * @param [in] cmd command to be added to the end of the execution queue
@@ -48,6 +116,13 @@ public:
   */
   void addCommandToFrontOfQueue(const std::string& cmd);
 
+  /**
+  * @brief Adds the command to the front of the execution queue
+  * @param [in] cmd command to be added to the front of the execution queue, eg cmd::Stop{}
+  * @return void
+  */
+  void addCommandToFrontOfQueue(const TelloCommand& cmd);
+
   /**
   * @brief clears the execution queue
   * @return void
@@ -79,13 +154,13 @@ public:
   void allowAutoLand();
 
   /**
-  * @brief sends the "emergency" command to the drone that will cause the motors to stop immediately and stops queue exection as well
+  * @brief sends the "emergency" command to the drone that will cause the motors to stop immediately and stops queue exection as well; the rc channel stops sending the stick setpoint
   * @return void
   */
   void emergency();
 
   /**
-  * @brief sends the "stop" command to the drone ad stops queue execution
+  * @brief sends the "stop" command to the drone ad stops queue execution; the rc channel stops sending the stick setpoint
   * @return void
   */
   void stop();
@@ -97,14 +172,41 @@ public:
   bool isExecutingQueue();
 
   /**
-  * @brief Enables autoland and sends the command "land" to the drone.
+  * @brief Enables autoland and sends the command "land" to the drone; the rc channel stops sending the stick setpoint
   * @return void
   */
   void land();
 
   /**
-  * @brief Destructor
+  * @brief set the stick setpoint sent by the rc channel, as in "rc a b c d"; never blocks
+  * @param [in] a left/right, -100 to 100
+  * @param [in] b forward/backward, -100 to 100
+  * @param [in] c up/down, -100 to 100
+  * @param [in] d yaw, -100 to 100
+  * @return void
+  * @details Only the latest setpoint is kept and sent at the rate of the rc
+  channel, so a burst of stick events costs one datagram per period. A setpoint
+  other than zero is sent every period; zero is sent a few times, in case a
+  datagram is lost, before the channel goes quiet.
+  */
+  void setRc(int a, int b, int c, int d);
+
+  /**
+  * @brief get the current counters of the command queue
+  * @return CommandQueueStats snapshot of the counters
+  */
+  CommandQueueStats getQueueStats() const;
+
+  /**
+  * @brief get the counters and round trip times of every type of command sent so far
+  * @return std::vector<CommandTypeStats> one entry per type sent or answered, in the order of command_table
+  */
+  std::vector<CommandTypeStats> getCommandStats() const;
+
+  /**
+  * @brief Destructor; waits for the handlers still queued on the io_service, unless it was stopped
   * @return none
+  * @details Must not be called from a handler of the io_service
   */
   ~CommandSocket();
 
@@ -112,24 +214,116 @@ private:
 
   void handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd) override;
   void handleSendCommand(const std::error_code& error, size_t bytes_sent, std::string cmd) override;
+  void processInjectedDatagram(const unsigned char* data, size_t size) override;
 
-  void waitForResponse();
-  void retry(const std::string& cmd);
-  void sendQueueCommands();
+  void processResponse(size_t bytes_recvd);
   void sendCommand(const std::string& cmd);
-  void doNotAutoLandWorker();
+  void sendCommand(const TelloCommand& cmd);
+  bool sendCommandIfIdle(const TelloCommand& cmd);
+  void sendOutOfBand(const TelloCommand& cmd);
+  void transmit(const TelloCommand& cmd, bool out_of_band = false);
+  void commandSent(const std::error_code& error, size_t bytes_sent, const TelloCommand& cmd);
+
+  // State machine of the execution queue; called with queue_mutex_ held
+  enum class QueueState{ Idle, AwaitingResponse, Delaying };
+  void sendQueueCommands();
+  void armTimer(std::chrono::steady_clock::duration after);
+  void cancelTimer();
+  void abandonInFlight();
+  void handleTimer(const std::error_code& error, uint64_t generation);
+  void armDnalTimer(std::chrono::steady_clock::duration after);
+  void handleDnalTimer(const std::error_code& error, uint64_t generation);
+
+  // Counters of the commands of one entry of command_table
+  struct CommandCounters{
+    LatencyHistogram rtt;
+    std::atomic<size_t> sent{0}, responses{0}, errors{0}, retries{0}, timeouts{0};
+  };
+  CommandCounters& counters(CommandId id);
+
+  void startRc();
+  void zeroRc();
+  void sendRc();
+  void armRcTimer();
+  void handleRcTimer(const std::error_code& error);
 
   enum{ max_length_ = 1024 };
-  bool waiting_for_response_ = false, execute_queue_ = false, dnal_ = false, on_ = true;
+  bool execute_queue_ = false, dnal_ = false, on_ = true;
   char data_[max_length_];
-  int timeout_, n_retries_ = 0, n_retries_allowed_ = 0, dnal_timeout = 7 /*dnal --> do not auto land*/ ;
-  std::string last_command_, response_;
-  std::deque<std::string> command_queue_;
-  std::mutex queue_mutex_, m, dnal_mutex;
-  std::condition_variable cv_execute_queue_, cv_dnal_;
-  std::chrono::system_clock::time_point command_sent_time_;
-
-  std::thread cmd_thread, dnal_thread;
+  std::chrono::milliseconds timeout_;
+  int n_retries_ = 0, n_retries_allowed_ = 0, dnal_timeout = 7 /*dnal --> do not auto land*/ ;
+  std::string response_;
+  TelloCommand last_command_;
+  std::deque<TelloCommand> command_queue_;
+  mutable std::mutex queue_mutex_;
+  std::chrono::steady_clock::time_point command_sent_time_;
+  size_t max_queue_depth_ = 0;
+  std::atomic<size_t> commands_sent_{0};
+
+  // Command of the queue awaiting its response, and the timer of its
+  // response or of a delay. A handler of the timer only acts if the
+  // generation it was armed with is still the current one.
+  QueueState queue_state_ = QueueState::Idle;
+  TelloCommand in_flight_;
+  // Responses owed to commands sent outside the queue, eg by the joystick,
+  // the terminal or a keyframe request; they are used up before a response
+  // ends the wait of the queue. Given up once the latest of those commands
+  // is older than timeout_, as a response may have been lost.
+  size_t out_of_band_awaiting_ = 0;
+  std::chrono::steady_clock::time_point out_of_band_sent_;
+  asio::steady_timer timer_;
+  uint64_t timer_generation_ = 0;
+  // Sends "rc 0 0 0 0" while automatic landing is disabled and no other
+  // command was sent for dnal_timeout seconds
+  asio::steady_timer dnal_timer_;
+  uint64_t dnal_generation_ = 0;
+  // Timer handlers, and send and receive handlers, not yet run; the
+  // destructor waits for them as they use the socket. Receive handlers
+  // return without receiving again once closing_ is set.
+  std::atomic<int> pending_timers_{0}, pending_io_{0};
+  std::atomic<bool> closing_{false};
+
+  // Buffers of the sends in progress. A command is copied into a free one
+  // for the asynchronous send, so sending allocates only if all are in use.
+  struct SendBuffer{
+    TelloCommand cmd;
+    std::atomic<bool> busy{false};
+  };
+  enum{ n_send_buffers_ = 8 };
+  std::array<SendBuffer, n_send_buffers_> send_buffers_;
+  std::atomic<unsigned> next_send_buffer_{0};
+  std::atomic<size_t> send_buffer_misses_{0};
+
+  // Indexed by CommandId; on the heap, as the histograms are large
+  std::unique_ptr<CommandCounters[]> command_counters_;
+  // Commands sent that await a response, oldest first, in a ring. A response
+  // is attributed to the oldest of the commands of its kind, of the queue or
+  // sent outside it; commands whose response is overdue are given up, and
+  // when the ring is full the oldest is overwritten.
+  struct AwaitedResponse{
+    CommandCounters* counters;
+    std::chrono::steady_clock::time_point since;
+    bool out_of_band;
+  };
+  enum{ n_awaited_ = 8 };
+  std::array<AwaitedResponse, n_awaited_> awaited_;
+  size_t awaited_first_ = 0, awaited_count_ = 0;
+  bool takeAwaited(bool out_of_band, std::chrono::steady_clock::time_point received, AwaitedResponse& answered);
+  size_t unmatched_responses_ = 0;
+  mutable std::mutex stats_mutex_;
+
+  // rc channel. The four values of the latest setpoint are packed as bytes
+  // into the low 32 bits, with rc_dirty_ set until the timer takes them, so
+  // setting a setpoint is a single atomic exchange. rc_active_ is set while
+  // the timer runs; only the setter that sets it starts the timer.
+  enum{ rc_zero_repeats_ = 3 };
+  static constexpr uint64_t rc_dirty_ = uint64_t(1) << 32;
+  std::chrono::steady_clock::duration rc_period_;
+  std::atomic<uint64_t> rc_setpoint_{0};
+  std::atomic<bool> rc_active_{false};
+  asio::steady_timer rc_timer_;
+  int rc_zero_left_ = 0;
+  std::atomic<size_t> rc_updates_{0}, rc_sent_{0}, rc_coalesced_{0};
 
   friend class Tello;
 };
@@ -0,0 +1,126 @@
+#ifndef DECODESCHEDULER_HPP
+#define DECODESCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* @class DecodeScheduler
+* @brief Fixed pool of worker threads shared by the video streams of all drones
+* @details Each stream owns a lane. The stream notifies its lane when it has
+work queued and a worker runs the lane's work function; a lane is never run
+by two workers at once, so the work of a stream is done in order. A notified
+lane is queued on the worker that last ran it, and idle workers steal lanes
+from busy ones, so a swarm spreads evenly over the cores.
+*/
+class DecodeScheduler{
+public:
+
+  /**
+  * @class Lane
+  * @brief Work of one stream, run by one worker at a time
+  */
+  class Lane : public std::enable_shared_from_this<Lane>{
+  public:
+
+    /**
+    * @brief have the lane's work function run soon; may be called from any thread
+    * @return void
+    * @details Cheap when the lane is already queued or running; a lane
+    notified while it runs is run again afterwards
+    */
+    void notify();
+
+    /**
+    * @brief stop running the lane, waiting for a running work function to return
+    * @return void
+    * @details Must be called before whatever the work function uses is destroyed, and not from the work function
+    */
+    void close();
+
+  private:
+
+    friend class DecodeScheduler;
+
+    Lane(DecodeScheduler& scheduler, std::function<bool()> work, size_t home);
+    void run(size_t worker);
+
+    DecodeScheduler& scheduler_;
+    const std::function<bool()> work_;
+    // Worker the lane is queued on when notified
+    size_t home_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool queued_ = false, running_ = false, notified_ = false, closed_ = false;
+  };
+
+  /**
+  * @brief Constructor
+  * @param [in] n_workers number of worker threads, 0 for one per core
+  * @return none
+  */
+  explicit DecodeScheduler(size_t n_workers = 0);
+
+  /**
+  * @brief Destructor; stops the workers
+  * @return none
+  */
+  ~DecodeScheduler();
+
+  DecodeScheduler(const DecodeScheduler&) = delete;
+  DecodeScheduler& operator=(const DecodeScheduler&) = delete;
+
+  /**
+  * @brief get the scheduler shared by the whole process, creating it if there is none
+  * @param [in] n_workers number of worker threads if the scheduler is created, 0 for one per core
+  * @return std::shared_ptr<DecodeScheduler> shared scheduler; it is destroyed with the last reference to it
+  */
+  static std::shared_ptr<DecodeScheduler> shared(size_t n_workers = 0);
+
+  /**
+  * @brief add a lane
+  * @param [in] work function doing some of the work of the lane; returns true if work is left, to be run again after the other lanes had their turn
+  * @return std::shared_ptr<Lane> lane, which has to be closed before the work function becomes invalid
+  */
+  std::shared_ptr<Lane> addLane(std::function<bool()> work);
+
+  /**
+  * @brief get the number of worker threads
+  * @return size_t number of workers
+  */
+  size_t workers() const;
+
+  /**
+  * @brief get the number of times a worker ran a lane queued on another worker
+  * @return size_t number of steals
+  */
+  size_t steals() const;
+
+private:
+
+  struct Worker{
+    std::deque<std::shared_ptr<Lane>> lanes;
+    std::mutex mutex;
+    std::thread thread;
+  };
+
+  void schedule(std::shared_ptr<Lane> lane, size_t worker);
+  bool takeLane(size_t worker, std::shared_ptr<Lane>* lane);
+  void workerLoop(size_t worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Number of queued lanes; workers sleep while there are none
+  size_t queued_ = 0;
+  bool on_ = true;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<size_t> next_home_{0}, steals_{0};
+};
+
+#endif // DECODESCHEDULER_HPP
@@ -0,0 +1,273 @@
+#ifndef FRAMEBUS_HPP
+#define FRAMEBUS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libavutil/frame.h>
+#include <opencv2/core/core.hpp>
+
+#include "frame_variants.hpp"
+
+/**
+* @struct VideoFrame
+* @brief Decoded frame as handed to the subscribers of a FrameBus
+* @details Copies share the image, so handing a frame on never copies
+pixels. The image is shared with every other subscriber of the same spec and
+must not be written to; clone it to modify it.
+*/
+struct VideoFrame{
+  /** \brief Number of the frame, counting from 1 */
+  uint64_t id = 0;
+  /** \brief Time the first datagram of the frame was received, if known */
+  std::chrono::steady_clock::time_point received;
+  /** \brief Image in the size and pixel format of the subscription */
+  cv::Mat image;
+};
+
+/**
+* @enum DropPolicy
+* @brief Frame dropped when a frame is published to a full subscription queue
+*/
+enum class DropPolicy{
+  /** \brief Replace the oldest queued frame; for consumers that want the latest frame, eg a display */
+  DropOldest,
+  /** \brief Drop the published frame; for consumers that want runs of consecutive frames, eg snapshots */
+  DropNewest
+};
+
+/**
+* @class FrameSubscription
+* @brief Bounded queue of the frames published to one subscriber
+* @details Publishing never blocks; a full queue drops a frame according to
+the drop policy, so a slow subscriber only loses frames of its own. A
+subscription either has a handler, called on a thread of its own, or is read
+with pop() and wait() by the subscriber.
+*/
+class FrameSubscription{
+public:
+
+  /**
+  * @brief Constructor; use FrameBus::subscribe
+  * @param [in] name name of the subscriber, eg for logging
+  * @param [in] spec size and pixel format of the images
+  * @param [in] queue_length maximum number of frames queued
+  * @param [in] policy frame dropped when the queue is full
+  * @param [in] on_request whether frames are only queued after request(), eg for snapshots
+  * @return none
+  */
+  FrameSubscription(const std::string& name, const FrameSpec& spec,
+    size_t queue_length, DropPolicy policy, bool on_request);
+
+  /**
+  * @brief Destructor; closes the subscription
+  * @return none
+  */
+  ~FrameSubscription();
+
+  FrameSubscription(const FrameSubscription&) = delete;
+  FrameSubscription& operator=(const FrameSubscription&) = delete;
+
+  /**
+  * @brief take the oldest queued frame without waiting
+  * @param [out] frame oldest queued frame
+  * @return bool false if no frame was queued
+  */
+  bool pop(VideoFrame& frame);
+
+  /**
+  * @brief take the oldest queued frame, waiting for one if none is queued
+  * @param [out] frame oldest queued frame
+  * @return bool false once the subscription is closed and every queued frame was taken
+  */
+  bool wait(VideoFrame& frame);
+
+  /**
+  * @brief queue the next few published frames; for subscriptions made on request
+  * @param [in] n_frames number of frames to queue, added to the frames still requested
+  * @return void
+  */
+  void request(int n_frames);
+
+  /**
+  * @brief whether the next published frame would be queued
+  * @return bool false for a closed subscription, or one made on request without frames requested
+  */
+  bool active() const;
+
+  /**
+  * @brief stop queueing frames; the frames still queued can be taken, and the handler thread returns once it has handled them
+  * @return void
+  */
+  void close();
+
+  /**
+  * @brief get the name of the subscriber
+  * @return const std::string& name
+  */
+  const std::string& name() const;
+
+  /**
+  * @brief get the size and pixel format of the images
+  * @return const FrameSpec& spec
+  */
+  const FrameSpec& spec() const;
+
+  /**
+  * @brief get the number of frames queued so far
+  * @return size_t number of frames queued
+  */
+  size_t queued() const;
+
+  /**
+  * @brief get the number of frames dropped as the queue was full
+  * @return size_t number of frames dropped
+  */
+  size_t dropped() const;
+
+private:
+
+  friend class FrameBus;
+
+  // Called by the publishing thread of the bus; false once closed
+  bool takeRequested();
+  void push(const VideoFrame& frame);
+  void startHandler(std::function<void(const VideoFrame&)> handler);
+
+  const std::string name_;
+  const FrameSpec spec_;
+  const DropPolicy policy_;
+  const bool on_request_;
+  // Only touched by the publishing thread
+  size_t variant_ = SIZE_MAX;
+
+  // Ring of queued frames; preallocated so queueing never allocates
+  std::vector<VideoFrame> ring_;
+  size_t head_ = 0, size_ = 0;
+  bool closed_ = false;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+
+  std::atomic<int> requested_{0};
+  std::atomic<size_t> queued_{0}, dropped_{0};
+};
+
+/**
+* @class FrameBus
+* @brief Hands every decoded frame to any number of subscribers without copying it
+* @details The decode stage publishes each frame once. Every subscriber
+declares the size and pixel format it needs, and each distinct image is
+converted once per frame, only if an active subscriber needs it; subscribers
+of the same spec share the image. Subscribing and unsubscribing are safe from
+any thread; only the decode stage may publish.
+*/
+class FrameBus{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] backend implementation of the full size YUV to BGR conversion
+  * @return none
+  */
+  explicit FrameBus(ConverterBackend backend = ConverterBackend::Auto);
+
+  /**
+  * @brief Destructor; closes every subscription
+  * @return none
+  */
+  ~FrameBus();
+
+  /**
+  * @brief subscribe to frames read with FrameSubscription::pop and wait
+  * @param [in] name name of the subscriber, eg for logging
+  * @param [in] spec size and pixel format of the images
+  * @param [in] queue_length maximum number of frames queued
+  * @param [in] policy frame dropped when the queue is full
+  * @param [in] on_request whether frames are only queued after FrameSubscription::request
+  * @return std::shared_ptr<FrameSubscription> subscription
+  */
+  std::shared_ptr<FrameSubscription> subscribe(const std::string& name, const FrameSpec& spec,
+    size_t queue_length = 2, DropPolicy policy = DropPolicy::DropOldest, bool on_request = false);
+
+  /**
+  * @brief subscribe to frames handed to a handler running on a thread of its own
+  * @param [in] name name of the subscriber, eg for logging
+  * @param [in] spec size and pixel format of the images
+  * @param [in] handler function called with every frame taken from the queue
+  * @param [in] queue_length maximum number of frames queued
+  * @param [in] policy frame dropped when the queue is full
+  * @return std::shared_ptr<FrameSubscription> subscription
+  */
+  std::shared_ptr<FrameSubscription> subscribe(const std::string& name, const FrameSpec& spec,
+    std::function<void(const VideoFrame&)> handler,
+    size_t queue_length = 2, DropPolicy policy = DropPolicy::DropOldest);
+
+  /**
+  * @brief remove and close a subscription
+  * @param [in] subscription subscription to remove
+  * @return void
+  */
+  void unsubscribe(const std::shared_ptr<FrameSubscription>& subscription);
+
+  /**
+  * @brief hand a decoded frame to every active subscriber, converting it as they need
+  * @param [in] frame decoded frame
+  * @param [in] received time the first datagram of the frame was received, if known
+  * @return uint64_t id given to the frame
+  */
+  uint64_t publish(const AVFrame& frame, std::chrono::steady_clock::time_point received);
+
+  /**
+  * @brief whether any subscriber would take the next frame published
+  * @return bool false if there is no subscriber, or none is active, eg only snapshots without any requested
+  * @details The decode stage need not decode frames while this is false
+  */
+  bool active() const;
+
+  /**
+  * @brief get the number of subscribers
+  * @return size_t number of subscribers
+  */
+  size_t subscribers() const;
+
+  /**
+  * @brief get the implementation of the full size YUV to BGR conversion in use
+  * @return ConverterBackend backend, never Auto
+  */
+  ConverterBackend backend() const;
+
+  /**
+  * @brief get the number of image buffers allocated for the subscribers
+  * @return size_t number of allocations
+  */
+  size_t allocations() const;
+
+  /**
+  * @brief get the number of image buffers allocated outside the frame pools
+  * @return size_t number of pool misses
+  */
+  size_t misses() const;
+
+private:
+
+  // Only touched by the publishing thread; the counters are copied out of
+  // the variants after every frame
+  FrameVariants variants_;
+  uint64_t next_id_ = 1;
+  std::vector<std::shared_ptr<FrameSubscription>> publishing_;
+  std::atomic<size_t> allocations_{0}, misses_{0};
+
+  std::vector<std::shared_ptr<FrameSubscription>> subscriptions_;
+  mutable std::mutex mutex_;
+};
+
+#endif // FRAMEBUS_HPP
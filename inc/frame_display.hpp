@@ -0,0 +1,86 @@
+#ifndef FRAMEDISPLAY_HPP
+#define FRAMEDISPLAY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_bus.hpp"
+#include "latency_histogram.hpp"
+
+/**
+* @class FrameDisplay
+* @brief Shows the frames of a subscription in a window from a thread of its own
+* @details The subscription is best made with a queue of one frame that
+drops the oldest frame: the display thread then always shows the most recent
+frame, and a frame that is replaced before it was shown is skipped, so a slow
+GUI never holds up the decoder.
+*/
+class FrameDisplay{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] window_name name of the window the frames are shown in
+  * @param [in] subscription subscription the frames are taken from; closed by the destructor
+  * @param [in] gui_mutex mutex held while drawing, eg when the window shares the GUI with the SLAM viewer; may be nullptr
+  * @return none
+  */
+  FrameDisplay(const std::string& window_name, std::shared_ptr<FrameSubscription> subscription,
+    std::mutex* gui_mutex = nullptr);
+
+  /**
+  * @brief Destructor
+  * @return none
+  */
+  ~FrameDisplay();
+
+  /**
+  * @brief get the number of frames shown so far
+  * @return size_t number of frames shown
+  */
+  size_t displayed() const;
+
+  /**
+  * @brief get the number of frames replaced by a newer frame before they were shown
+  * @return size_t number of frames skipped
+  */
+  size_t skipped() const;
+
+  /**
+  * @brief get the rate at which frames were shown over the last second or so
+  * @return double frames per second
+  */
+  double fps() const;
+
+  /**
+  * @brief get the time from receiving frames to showing them
+  * @return const LatencyHistogram& latencies of the frames published with a receive time
+  */
+  const LatencyHistogram& latency() const;
+
+private:
+
+  void worker();
+  void show(const cv::Mat& image, std::chrono::steady_clock::time_point received);
+
+  const std::string window_name_;
+  std::shared_ptr<FrameSubscription> subscription_;
+  std::mutex* gui_mutex_;
+  std::thread thread_;
+
+  // Only touched by the display thread
+  std::chrono::steady_clock::time_point fps_start_;
+  size_t fps_frames_ = 0;
+
+  std::atomic<size_t> displayed_{0};
+  std::atomic<double> fps_{0};
+  LatencyHistogram latency_;
+};
+
+#endif // FRAMEDISPLAY_HPP
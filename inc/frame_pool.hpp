@@ -0,0 +1,62 @@
+#ifndef FRAMEPOOL_HPP
+#define FRAMEPOOL_HPP
+
+#include <atomic>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+* @class FramePool
+* @brief Pool of reusable image buffers shared with frame consumers
+* @details Buffers are handed out as ordinary cv::Mat objects, so consumers
+keep a buffer alive simply by holding a copy of the cv::Mat header. A buffer
+is reused once the pool holds the only reference to it, which makes steady
+state decoding free of heap allocations and image copies. Only the decode
+stage may call acquire, from one thread at a time.
+*/
+class FramePool{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] max_buffers maximum number of buffers kept in the pool
+  * @return none
+  */
+  explicit FramePool(size_t max_buffers = 8);
+
+  /**
+  * @brief get a buffer that is not referenced by any consumer
+  * @param [in] rows number of rows of the image
+  * @param [in] cols number of columns of the image
+  * @param [in] type OpenCV type of the image, eg CV_8UC3
+  * @param [in] min_bytes minimum size of the buffer in bytes, eg from ConverterRGB24::predict_size
+  * @return cv::Mat continuous image of the requested size and type
+  * @details When every pooled buffer is in use and the pool is full a
+  buffer that is not pooled is allocated and counted as a pool miss
+  */
+  cv::Mat acquire(int rows, int cols, int type, size_t min_bytes = 0);
+
+  /**
+  * @brief get the number of buffers allocated by the pool so far
+  * @return size_t number of allocations
+  */
+  size_t allocations() const;
+
+  /**
+  * @brief get the number of times a buffer had to be allocated outside the pool
+  * @return size_t number of pool misses
+  */
+  size_t misses() const;
+
+private:
+
+  static bool isFree(const cv::Mat& buffer);
+  static cv::Mat allocate(int rows, int cols, int type, size_t min_bytes);
+
+  std::vector<cv::Mat> buffers_;
+  const size_t max_buffers_;
+  std::atomic<size_t> allocations_{0}, misses_{0};
+};
+
+#endif // FRAMEPOOL_HPP
@@ -0,0 +1,81 @@
+#ifndef FRAMESLAB_HPP
+#define FRAMESLAB_HPP
+
+#include <cstddef>
+#include <memory>
+
+/**
+* @class FrameSlab
+* @brief Growable contiguous buffer into which the datagrams of a frame are received directly
+* @details Datagrams are written to the free space at the end of the slab, so
+an assembled frame is available as one contiguous block without copying each
+packet. Slabs are recycled between frames and keep their capacity, hence the
+buffer only has to grow while the stream is warming up or when a frame is larger
+than any frame seen before.
+*/
+class FrameSlab{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] capacity initial capacity in bytes
+  * @return none
+  */
+  explicit FrameSlab(size_t capacity = 0);
+
+  FrameSlab(FrameSlab&& other) noexcept;
+  FrameSlab& operator=(FrameSlab&& other) noexcept;
+
+  /**
+  * @brief get space for n bytes after the data already in the slab, growing the slab if required
+  * @param [in] n number of bytes that will be written
+  * @return unsigned char* pointer to the first writable byte
+  * @details The pointer is invalidated by the next call to reserveTail
+  */
+  unsigned char* reserveTail(size_t n);
+
+  /**
+  * @brief mark n bytes written to the space returned by reserveTail as part of the data
+  * @param [in] n number of bytes written
+  * @return void
+  */
+  void commit(size_t n);
+
+  /**
+  * @brief discard the data, keeping the capacity
+  * @return void
+  */
+  void clear();
+
+  /**
+  * @brief discard the data after the first n bytes, keeping the capacity
+  * @param [in] n number of bytes to keep; at most size()
+  * @return void
+  */
+  void truncate(size_t n);
+
+  /**
+  * @brief get the data held in the slab
+  * @return const unsigned char* pointer to the first byte of data
+  */
+  const unsigned char* data() const;
+
+  /**
+  * @brief get the number of bytes of data held in the slab
+  * @return size_t number of bytes
+  */
+  size_t size() const;
+
+  /**
+  * @brief get the number of bytes the slab can hold without growing
+  * @return size_t number of bytes
+  */
+  size_t capacity() const;
+
+private:
+
+  std::unique_ptr<unsigned char[]> buffer_;
+  size_t size_ = 0, capacity_ = 0;
+};
+
+#endif // FRAMESLAB_HPP
@@ -0,0 +1,123 @@
+#ifndef FRAMEVARIANTS_HPP
+#define FRAMEVARIANTS_HPP
+
+#include <memory>
+#include <vector>
+
+#include <libavutil/frame.h>
+#include <opencv2/core/core.hpp>
+
+#include "frame_pool.hpp"
+#include "h264decoder.hpp"
+
+/**
+* @struct FrameSpec
+* @brief Size and pixel format of the images a frame consumer needs
+* @details A width or height of 0 follows the decoded frame: both 0 is the
+full frame, one of them 0 keeps the aspect ratio of the frame
+*/
+struct FrameSpec{
+  /** \brief Width of the image, 0 to follow the frame */
+  int width = 0;
+  /** \brief Height of the image, 0 to follow the frame */
+  int height = 0;
+  /** \brief Pixel format of the image */
+  OutputFormat format = OutputFormat::BGR24;
+
+  bool operator==(const FrameSpec& other) const {
+    return width == other.width && height == other.height && format == other.format;
+  }
+};
+
+/**
+* @class FrameVariants
+* @brief Converts each decoded frame to the sizes and pixel formats its consumers declared, each at most once
+* @details Consumers register the FrameSpec they need once and get back the
+index of its variant; consumers that need the same spec share a variant. A
+variant is converted on the first get() after a frame was set, so variants
+nobody asks for are never converted. Full size images use the fast
+converters, other sizes are scaled and converted in one pass. Images come
+from a FramePool per variant, so the rules of FramePool apply: only the
+decode stage may set frames and get images, from one thread at a time, and
+consumers keep an image alive by holding a copy of its cv::Mat.
+*/
+class FrameVariants{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] backend implementation of the full size YUV to BGR conversion
+  * @return none
+  */
+  explicit FrameVariants(ConverterBackend backend = ConverterBackend::Auto);
+
+  /**
+  * @brief register the spec of a consumer
+  * @param [in] spec size and pixel format the consumer needs
+  * @return size_t index of the variant, passed to get()
+  */
+  size_t add(const FrameSpec& spec);
+
+  /**
+  * @brief set the decoded frame the variants are converted from
+  * @param [in] frame decoded frame; must stay valid until the next call or release()
+  * @return void
+  */
+  void setFrame(const AVFrame& frame);
+
+  /**
+  * @brief get a variant of the current frame, converting it if this is the first request since setFrame()
+  * @param [in] variant index returned by add()
+  * @return cv::Mat image of the spec of the variant
+  */
+  cv::Mat get(size_t variant);
+
+  /**
+  * @brief forget the current frame and drop the references to its images so their buffers can be reused
+  * @return void
+  */
+  void release();
+
+  /**
+  * @brief get the number of distinct variants registered
+  * @return size_t number of variants
+  */
+  size_t size() const;
+
+  /**
+  * @brief get the implementation of the full size YUV to BGR conversion in use
+  * @return ConverterBackend backend, never Auto
+  */
+  ConverterBackend backend() const;
+
+  /**
+  * @brief get the number of image buffers allocated by the pools of the variants
+  * @return size_t number of allocations
+  */
+  size_t allocations() const;
+
+  /**
+  * @brief get the number of image buffers allocated outside the pools of the variants
+  * @return size_t number of pool misses
+  */
+  size_t misses() const;
+
+private:
+
+  struct Variant{
+    FrameSpec spec;
+    std::unique_ptr<FramePool> pool;
+    std::unique_ptr<ConverterScaled> scaler;
+    cv::Mat image;
+    bool converted = false;
+  };
+
+  static void resolve(const FrameSpec& spec, const AVFrame& frame, int* width, int* height);
+
+  std::vector<Variant> variants_;
+  const AVFrame* frame_ = nullptr;
+  ConverterRGB24 bgr_converter_;
+  ConverterGray8 gray_converter_;
+};
+
+#endif // FRAMEVARIANTS_HPP
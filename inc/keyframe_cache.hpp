@@ -0,0 +1,102 @@
+#ifndef KEYFRAMECACHE_HPP
+#define KEYFRAMECACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "frame_slab.hpp"
+
+/**
+* @class KeyframeCache
+* @brief Copy of the access units since the last keyframe, to restart decoding without waiting for the next one
+* @details Holds the latest keyframe and every access unit after it, as long
+as none was lost, and the latest sequence and picture parameter sets. Feeding
+them to a reset decoder brings it to the current picture, eg when a subscriber
+attaches while decoding is paused or after the decoder failed. The cache is
+bounded; once a group of pictures outgrows it, it stays empty until the next
+keyframe. The data is copied into a slab that keeps its capacity, so the cache
+stops allocating once it has seen the largest group of pictures. Not thread
+safe; only the decode stage uses it.
+*/
+class KeyframeCache{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] max_bytes maximum number of bytes of access units held
+  * @param [in] max_access_units maximum number of access units held
+  * @return none
+  */
+  KeyframeCache(size_t max_bytes, size_t max_access_units);
+
+  /**
+  * @brief add the next access unit of the stream
+  * @param [in] data Annex-B H.264 data of the access unit
+  * @param [in] size number of bytes of data
+  * @param [in] pts timestamp the access unit is decoded with
+  * @param [in] is_idr whether the access unit holds a keyframe, which starts the cache over
+  * @param [in] intact false if data was lost before or in the access unit, which empties the cache
+  * @return void
+  */
+  void add(const unsigned char* data, size_t size, int64_t pts, bool is_idr, bool intact);
+
+  /**
+  * @brief empty the cache until the next keyframe, eg if decoding the cached data failed
+  * @return void
+  */
+  void invalidate();
+
+  /**
+  * @brief whether the cache holds a keyframe and every access unit after it
+  * @return bool true if decoding can restart from the cache
+  */
+  bool valid() const;
+
+  /**
+  * @brief hand the cached data to a function in stream order, starting with the parameter sets if the keyframe lacks them
+  * @param [in] f function called with the data, size and timestamp of every access unit
+  * @return void
+  */
+  void forEach(const std::function<void(const unsigned char*, size_t, int64_t)>& f) const;
+
+  /**
+  * @brief get the number of access units held
+  * @return size_t number of access units
+  */
+  size_t size() const;
+
+  /**
+  * @brief get the number of bytes of access units held
+  * @return size_t number of bytes
+  */
+  size_t bytes() const;
+
+  /**
+  * @brief get the number of times a group of pictures did not fit in the cache
+  * @return size_t number of overflows
+  */
+  size_t overflows() const;
+
+private:
+
+  struct Entry{
+    size_t offset, size;
+    int64_t pts;
+  };
+
+  bool keepParameterSets(const unsigned char* data, size_t size);
+
+  const size_t max_bytes_, max_access_units_;
+  FrameSlab data_;
+  std::vector<Entry> entries_;
+  bool valid_ = false;
+  // Latest parameter sets, each with a start code, and whether the cached
+  // keyframe came with its own
+  std::vector<unsigned char> sps_, pps_;
+  bool keyframe_has_parameter_sets_ = false;
+  size_t overflows_ = 0;
+};
+
+#endif // KEYFRAMECACHE_HPP
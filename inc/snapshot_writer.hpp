@@ -0,0 +1,71 @@
+#ifndef SNAPSHOTWRITER_HPP
+#define SNAPSHOTWRITER_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "frame_bus.hpp"
+
+/**
+* @class SnapshotWriter
+* @brief Encodes and saves the frames of a subscription on a background thread
+* @details The subscription is made on request, so frames are only converted
+and queued for the snapshots asked for. Its queue is bounded and drops the
+newest frame; when it is full further frames are dropped rather than holding
+up the decoder.
+*/
+class SnapshotWriter{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] directory directory the snapshots are saved to
+  * @param [in] subscription subscription made on request the frames are taken from; closed by the destructor
+  * @return none
+  */
+  SnapshotWriter(const std::string& directory, std::shared_ptr<FrameSubscription> subscription);
+
+  /**
+  * @brief Destructor; saves the frames still queued before returning
+  * @return none
+  */
+  ~SnapshotWriter();
+
+  /**
+  * @brief save the next few frames published
+  * @param [in] n_frames number of consecutive frames to save
+  * @return void
+  */
+  void take(int n_frames);
+
+  /**
+  * @brief get the number of snapshots saved so far
+  * @return size_t number of snapshots saved
+  */
+  size_t written() const;
+
+  /**
+  * @brief get the number of snapshots dropped as the queue was full
+  * @return size_t number of snapshots dropped
+  */
+  size_t dropped() const;
+
+private:
+
+  void worker();
+  std::string nextFileName(const VideoFrame& frame);
+
+  const std::string directory_;
+  std::shared_ptr<FrameSubscription> subscription_;
+  std::thread thread_;
+
+  // Only touched by the worker thread
+  std::string last_stamp_;
+  int same_stamp_count_ = 0;
+
+  std::atomic<size_t> written_{0};
+};
+
+#endif // SNAPSHOTWRITER_HPP
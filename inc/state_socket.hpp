@@ -29,6 +29,10 @@ private:
 
   virtual void handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd) override;
   virtual void handleSendCommand(const std::error_code& error, size_t bytes_sent, std::string cmd) override;
+  virtual void processInjectedDatagram(const unsigned char* data, size_t size) override;
+
+  void receive();
+  void processResponse(size_t bytes_recvd);
 
   enum{ max_length_ = 1024 };
   bool received_response_ = true;
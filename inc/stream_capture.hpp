@@ -0,0 +1,144 @@
+#ifndef STREAMCAPTURE_HPP
+#define STREAMCAPTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Capture file format. All integers are little endian.
+
+  header: 8 byte magic "TELLOCAP", u32 version, u64 wall clock time at which
+          the capture started in nanoseconds since the epoch
+  record: u64 receive time in nanoseconds since the capture started (steady
+          clock), u8 stream id, u32 payload length, payload
+
+Records are appended in the order the datagrams were received; a file cut
+short by a crash is readable up to its last complete record.
+*/
+
+/**
+* @enum CaptureStream
+* @brief Identifies the socket a captured datagram was received on
+*/
+enum class CaptureStream : uint8_t{
+  Command = 0,
+  State = 1,
+  Video = 2
+};
+
+/**
+* @struct CaptureRecord
+* @brief Datagram read back from a capture file
+*/
+struct CaptureRecord{
+  /** \brief Receive time in nanoseconds since the capture started */
+  uint64_t timestamp_ns = 0;
+  /** \brief Socket the datagram was received on */
+  CaptureStream stream = CaptureStream::Command;
+  /** \brief Contents of the datagram */
+  std::vector<unsigned char> payload;
+};
+
+/**
+* @class CaptureWriter
+* @brief Appends received datagrams to a capture file
+* @details Thread safe; the sockets of a drone share one writer.
+*/
+class CaptureWriter{
+public:
+
+  /**
+  * @brief Constructor; creates the file and writes the header
+  * @param [in] file_name path of the capture file
+  * @return none
+  */
+  explicit CaptureWriter(const std::string& file_name);
+
+  CaptureWriter(const CaptureWriter&) = delete;
+  CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+  /**
+  * @brief Destructor; flushes and closes the file
+  * @return none
+  */
+  ~CaptureWriter();
+
+  /**
+  * @brief append a datagram, timestamped now
+  * @param [in] stream socket the datagram was received on
+  * @param [in] data contents of the datagram
+  * @param [in] size size of the datagram in bytes
+  * @return void
+  */
+  void write(CaptureStream stream, const unsigned char* data, size_t size);
+
+  /**
+  * @brief whether the file could be created
+  * @return bool true if datagrams are being captured
+  */
+  bool isOpen() const;
+
+  /**
+  * @brief get the number of datagrams captured so far
+  * @return size_t number of datagrams
+  */
+  size_t records() const;
+
+private:
+
+  std::FILE* file_ = nullptr;
+  std::mutex mutex_;
+  std::chrono::steady_clock::time_point start_time_;
+  std::atomic<size_t> records_{0};
+};
+
+/**
+* @class CaptureReader
+* @brief Reads the datagrams of a capture file in order
+*/
+class CaptureReader{
+public:
+
+  /**
+  * @brief Constructor; opens the file and checks the header
+  * @param [in] file_name path of the capture file
+  * @return none
+  */
+  explicit CaptureReader(const std::string& file_name);
+
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  ~CaptureReader();
+
+  /**
+  * @brief whether the file was opened and has a valid header
+  * @return bool true if records can be read
+  */
+  bool isOpen() const;
+
+  /**
+  * @brief read the next record; the payload buffer of record is reused
+  * @param [out] record record read
+  * @return bool false at the end of the file or on a truncated record
+  */
+  bool next(CaptureRecord& record);
+
+  /**
+  * @brief get the wall clock time at which the capture started
+  * @return uint64_t nanoseconds since the epoch
+  */
+  uint64_t startTime() const;
+
+private:
+
+  std::FILE* file_ = nullptr;
+  uint64_t start_time_ns_ = 0;
+};
+
+#endif // STREAMCAPTURE_HPP
@@ -0,0 +1,70 @@
+#ifndef STREAMRECORDER_HPP
+#define STREAMRECORDER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct AVFormatContext;
+struct AVPacket;
+struct AVStream;
+
+/**
+* @class StreamRecorder
+* @brief Writes the H.264 stream received from the drone to a video file without re-encoding it
+* @details The container is chosen from the file extension (eg .mp4, .mkv).
+Access units are muxed as received and timestamped with their receive time,
+so recording costs little more than the disk bandwidth and frames lost on
+the way keep the timing of the recording correct. Nothing is written until
+the first access unit that carries an SPS, a PPS and an IDR slice.
+*/
+class StreamRecorder{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] file_name path of the video file to be written
+  * @return none
+  */
+  explicit StreamRecorder(const std::string& file_name);
+
+  StreamRecorder(const StreamRecorder&) = delete;
+  StreamRecorder& operator=(const StreamRecorder&) = delete;
+
+  /**
+  * @brief Destructor; finalises the file
+  * @return none
+  */
+  ~StreamRecorder();
+
+  /**
+  * @brief write an access unit to the file
+  * @param [in] data Annex-B H.264 data of the access unit
+  * @param [in] size size of data in bytes
+  * @param [in] received time at which the access unit was received
+  * @return void
+  */
+  void write(const unsigned char* data, size_t size, std::chrono::steady_clock::time_point received);
+
+  /**
+  * @brief get the number of access units written to the file
+  * @return size_t number of access units
+  */
+  size_t framesWritten() const;
+
+private:
+
+  bool open(const unsigned char* data, size_t size);
+  void close();
+
+  const std::string file_name_;
+  AVFormatContext* format_context_ = nullptr;
+  AVStream* stream_ = nullptr;
+  AVPacket* packet_ = nullptr;
+  bool opened_ = false, failed_ = false;
+  std::chrono::steady_clock::time_point start_time_;
+  int64_t last_pts_ = -1;
+  size_t frames_written_ = 0;
+};
+
+#endif // STREAMRECORDER_HPP
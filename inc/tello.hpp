@@ -3,6 +3,7 @@
 
 #include  <memory>
 
+#include "capture_replayer.hpp"
 #include "command_socket.hpp"
 #include "video_socket.hpp"
 #include "state_socket.hpp"
@@ -33,7 +34,7 @@ public:
   * @param [in] camera_config_file
   * @param [in] vocabulary_file
   * @param [in] n_retries number of retries for command if no response received
-  * @param [in] timeout timeout before a command is said to have failed and is resent if retries are enabled
+  * @param [in] timeout seconds, eg 0.5, before a command is said to have failed and is resent if retries are enabled
   * @param [in] load_map_db_path path and file name from which the map must be loaded
   * @param [in] save_map_db_path path and file name to which the map must be saved
   * @param [in] mask_img_path path to pattern mask input images
@@ -41,6 +42,18 @@ public:
   * @param [in] continue_mapping continue adding to the map even when a map has been loaded
   * @param [in] scale scale for SLAM
   * @param [in]  sequence_file file containing a sequence of commands that will be added to execute queue
+  * @param [in] decoder_threads number of threads used by the H.264 decoder, 0 for one per core; one by default, as the decode workers already use every core
+  * @param [in] decoder_thread_type whether the H.264 decoder uses frame (higher throughput, adds latency) or slice threading
+  * @param [in] converter_backend implementation of the YUV to BGR conversion; by default the fastest supported by the CPU
+  * @param [in] snapshot_burst number of consecutive frames saved when a snapshot is taken
+  * @param [in] capture_file file every datagram received from the drone is captured to; nothing is captured if empty
+  * @param [in] request_keyframes send "streamon" to get a keyframe sooner when video data was lost
+  * @param [in] preview_width width of the pilot view, 0 to follow the frame (keeping the aspect ratio if preview_height is set)
+  * @param [in] preview_height height of the pilot view, 0 to follow the frame (keeping the aspect ratio if preview_width is set)
+  * @param [in] decode_workers number of threads decoding the video of every drone, 0 for one per core; the first drone created sets it
+  * @param [in] frame_export shared memory object the decoded frames are exported to, eg "/tello_frames", and their size and pixel format; nothing is exported by default
+  * @param [in] show_video show the pilot view; with nothing else using the frames, eg in a swarm, they are then not decoded at all
+  * @param [in] rc_rate rate in Hz at which the latest stick setpoint is sent to the drone
   * @return none
   */
   Tello(asio::io_service& io_service,
@@ -52,14 +65,26 @@ public:
         const std::string camera_config_file = "../camera_config.yaml",
         const std::string vocabulary_file = "../orb_vocab.dbow2",
         const int n_retries = 0,
-        const int timeout = 5,
+        const double timeout = 5,
         const std::string load_map_db_path = "",
         const std::string save_map_db_path = "",
         const std::string mask_img_path = "",
         bool load_map = false,
         bool continue_mapping = false,
         float scale = 1.0,
-        const std::string sequence_file = ""
+        const std::string sequence_file = "",
+        const int decoder_threads = 1,
+        const H264ThreadType decoder_thread_type = H264ThreadType::Slice,
+        const ConverterBackend converter_backend = ConverterBackend::Auto,
+        const int snapshot_burst = 1,
+        const std::string capture_file = "",
+        const bool request_keyframes = false,
+        const int preview_width = 0,
+        const int preview_height = 0,
+        const int decode_workers = 0,
+        const FrameExportOptions& frame_export = FrameExportOptions(),
+        const bool show_video = true,
+        const int rc_rate = 30
       );
 
   /**
@@ -69,6 +94,27 @@ public:
   */
   void readSequence(const std::string& file);
 
+  /**
+  * @brief feeds a capture file back through the command, state and video sockets
+  * @param [in] file name of the capture file
+  * @param [in] speed 1 to replay in real time, 0 for as fast as possible
+  * @return size_t number of datagrams replayed
+  * @details Blocks until the replay is done, so it must not be called from a
+  handler of the io_service. The sockets stop receiving from and sending to
+  the drone, so this is meant to be used without a drone on the network
+  */
+  size_t replayCapture(const std::string& file, double speed = 1.0);
+
+  /**
+  * @brief replay a capture file, as replayCapture(), on a thread of its own
+  * @param [in] file name of the capture file
+  * @param [in] speed 1 to replay in real time, 0 for as fast as possible
+  * @return void
+  * @details Returns at once; the replay is stopped when the Tello is destroyed.
+  Only one replay can be started
+  */
+  void startReplay(const std::string& file, double speed = 1.0);
+
   /**
   * @brief Destructor
   * @return none
@@ -98,6 +144,9 @@ private:
   void jsToCommand(ButtonId update);
   void jsToCommand(AxisId update);
   bool run_ = true;
+  const int snapshot_burst_;
+  std::unique_ptr<CaptureReplayer> replayer_;
+  std::thread replay_thread_;
 
 #ifdef USE_TERMINAL
   std::unique_ptr<Terminal> term_;
@@ -0,0 +1,220 @@
+#ifndef TELLOCOMMAND_HPP
+#define TELLOCOMMAND_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+* @enum CommandId
+* @brief Commands of the Tello SDK known to the command socket, in the order of command_table
+*/
+enum class CommandId : uint8_t{
+  Command, Takeoff, Land, Emergency, Stop, Streamon, Streamoff, Mon, Moff,
+  Up, Down, Left, Right, Forward, Back, Cw, Ccw, Flip, Go, Curve, Speed, Rc,
+  SpeedQuery, BatteryQuery, TimeQuery, WifiQuery, SdkQuery, SerialQuery,
+  /** \brief Pause of the execution queue, not sent to the drone */
+  Delay,
+  /** \brief Any other command, sent as given */
+  Raw
+};
+
+/**
+* @struct CommandSpec
+* @brief How the command socket handles a command
+*/
+struct CommandSpec{
+  /** \brief Command the entry describes */
+  CommandId id;
+  /** \brief First word of the command on the wire; empty for Raw */
+  const char* word;
+  /** \brief Whether the drone responds; the queue only waits for commands that it responds to */
+  bool expects_response;
+  /** \brief Whether the command may be resent when no response arrives; not for manoeuvres, which would run twice if only the response was lost */
+  bool retry;
+  /** \brief Sent at once, without waiting for the response to the previous command of the queue */
+  bool preempts;
+  /** \brief Handled by the execution queue rather than sent */
+  bool local;
+};
+
+/**
+* @brief Table of the commands, indexed by CommandId
+*/
+constexpr CommandSpec command_table[] = {
+  {CommandId::Command,      "command",   true,  true,  false, false},
+  {CommandId::Takeoff,      "takeoff",   true,  true,  false, false},
+  {CommandId::Land,         "land",      true,  true,  false, false},
+  {CommandId::Emergency,    "emergency", true,  true,  true,  false},
+  {CommandId::Stop,         "stop",      true,  true,  true,  false},
+  {CommandId::Streamon,     "streamon",  true,  true,  false, false},
+  {CommandId::Streamoff,    "streamoff", true,  true,  false, false},
+  {CommandId::Mon,          "mon",       true,  true,  false, false},
+  {CommandId::Moff,         "moff",      true,  true,  false, false},
+  {CommandId::Up,           "up",        true,  false, false, false},
+  {CommandId::Down,         "down",      true,  false, false, false},
+  {CommandId::Left,         "left",      true,  false, false, false},
+  {CommandId::Right,        "right",     true,  false, false, false},
+  {CommandId::Forward,      "forward",   true,  false, false, false},
+  {CommandId::Back,         "back",      true,  false, false, false},
+  {CommandId::Cw,           "cw",        true,  false, false, false},
+  {CommandId::Ccw,          "ccw",       true,  false, false, false},
+  {CommandId::Flip,         "flip",      true,  false, false, false},
+  {CommandId::Go,           "go",        true,  false, false, false},
+  {CommandId::Curve,        "curve",     true,  false, false, false},
+  {CommandId::Speed,        "speed",     true,  true,  false, false},
+  {CommandId::Rc,           "rc",        false, false, false, false},
+  {CommandId::SpeedQuery,   "speed?",    true,  true,  false, false},
+  {CommandId::BatteryQuery, "battery?",  true,  true,  false, false},
+  {CommandId::TimeQuery,    "time?",     true,  true,  false, false},
+  {CommandId::WifiQuery,    "wifi?",     true,  true,  false, false},
+  {CommandId::SdkQuery,     "sdk?",      true,  true,  false, false},
+  {CommandId::SerialQuery,  "sn?",       true,  true,  false, false},
+  {CommandId::Delay,        "delay",     false, false, false, true},
+  {CommandId::Raw,          "",          true,  true,  false, false}
+};
+
+/** \brief Number of entries of command_table */
+constexpr size_t command_count = sizeof(command_table) / sizeof(command_table[0]);
+
+namespace tello_command{
+  constexpr bool inOrder(size_t i = 0){
+    return i == command_count ||
+      (static_cast<size_t>(command_table[i].id) == i && inOrder(i + 1));
+  }
+}
+static_assert(tello_command::inOrder(), "command_table has to be in the order of CommandId");
+static_assert(static_cast<size_t>(CommandId::Raw) + 1 == command_count, "Every CommandId needs an entry in command_table");
+
+/**
+* @brief get the entry of a command in the command table
+* @param [in] id command
+* @return const CommandSpec& entry of the command
+*/
+constexpr const CommandSpec& commandSpec(CommandId id){
+  return command_table[static_cast<size_t>(id)];
+}
+
+/**
+* @enum MoveDirection
+* @brief Direction of a straight move, in the order of the commands from Up to Back
+*/
+enum class MoveDirection : uint8_t{ Up, Down, Left, Right, Forward, Back };
+
+/**
+* @enum FlipDirection
+* @brief Direction of a flip, as sent to the drone
+*/
+enum class FlipDirection : char{ Left = 'l', Right = 'r', Forward = 'f', Back = 'b' };
+
+/** \brief Arguments of the typed commands, each converted to a TelloCommand */
+namespace cmd{
+  /** \brief Takes off */
+  struct Takeoff{};
+  /** \brief Lands */
+  struct Land{};
+  /** \brief Hovers in place */
+  struct Stop{};
+  /** \brief Stops the motors at once */
+  struct Emergency{};
+  /** \brief Moves cm centimetres, 20 to 500, in a direction */
+  struct Move{ MoveDirection dir; int cm; };
+  /** \brief Turns degrees, 1 to 360, clockwise or counterclockwise */
+  struct Rotate{ bool clockwise; int degrees; };
+  /** \brief Flips in a direction */
+  struct Flip{ FlipDirection dir; };
+  /** \brief Stick setpoint: left/right, forward/backward, up/down and yaw, each -100 to 100 */
+  struct Rc{ int a, b, c, d; };
+  /** \brief Reads a value of the drone; what is one of the query commands, eg CommandId::BatteryQuery */
+  struct Query{ CommandId what; };
+  /** \brief Pauses the execution queue */
+  struct Delay{ double seconds; };
+}
+
+/**
+* @class TelloCommand
+* @brief Command serialized into a fixed buffer, ready to be sent
+* @details Building a command writes its wire format once, without
+allocating, and keeps its CommandId, so the command socket classifies it
+through command_table rather than by comparing strings. Commands are
+trivially copyable and can live on the stack or in a queue.
+*/
+class TelloCommand{
+public:
+
+  /** \brief Longest command, in bytes */
+  enum{ max_size = 95 };
+
+  /**
+  * @brief Constructor; an empty Raw command
+  * @return none
+  */
+  TelloCommand();
+
+  /**
+  * @brief Constructor for the commands without arguments, eg CommandId::Takeoff or CommandId::BatteryQuery
+  * @param [in] id command; commands that take arguments are sent without them
+  * @return none
+  */
+  explicit TelloCommand(CommandId id);
+
+  TelloCommand(cmd::Takeoff);
+  TelloCommand(cmd::Land);
+  TelloCommand(cmd::Stop);
+  TelloCommand(cmd::Emergency);
+  TelloCommand(const cmd::Move& move);
+  TelloCommand(const cmd::Rotate& rotate);
+  TelloCommand(const cmd::Flip& flip);
+  TelloCommand(const cmd::Rc& rc);
+  TelloCommand(const cmd::Query& query);
+  TelloCommand(const cmd::Delay& delay);
+
+  /**
+  * @brief parse a command given as text, eg from a sequence file or the terminal
+  * @param [in] text command; leading and trailing white space is ignored
+  * @param [out] command the command, Raw if the first word is not in command_table
+  * @return bool false if the text is empty or longer than max_size
+  */
+  static bool parse(const std::string& text, TelloCommand& command);
+
+  /**
+  * @brief get the command
+  * @return CommandId command
+  */
+  CommandId id() const { return id_; }
+
+  /**
+  * @brief get the entry of the command in command_table
+  * @return const CommandSpec& entry of the command
+  */
+  const CommandSpec& spec() const { return commandSpec(id_); }
+
+  /**
+  * @brief get the wire format of the command
+  * @return const char* text of the command, null terminated
+  */
+  const char* data() const { return data_; }
+
+  /**
+  * @brief get the length of the wire format
+  * @return size_t number of bytes, without the null terminator
+  */
+  size_t size() const { return size_; }
+
+  /**
+  * @brief get the wire format as a string, eg for logging
+  * @return std::string text of the command
+  */
+  std::string text() const { return std::string(data_, size_); }
+
+private:
+
+  void append(const char* text);
+  void append(int value);
+
+  CommandId id_ = CommandId::Raw;
+  uint8_t size_ = 0;
+  char data_[max_size + 1] = {};
+};
+
+#endif // TELLOCOMMAND_HPP
@@ -1,19 +1,134 @@
 #ifndef VIDEOSOCKET_HPP
 #define VIDEOSOCKET_HPP
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <libavutil/frame.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/videoio.hpp>
 
+#include "access_unit.hpp"
 #include "base_socket.hpp"
+#include "decode_scheduler.hpp"
+#include "frame_display.hpp"
+#include "frame_bus.hpp"
+#include "frame_shm.hpp"
+#include "frame_slab.hpp"
+#include "h264_nal.hpp"
 #include "h264decoder.hpp"
+#include "keyframe_cache.hpp"
+#include "latency_histogram.hpp"
+#include "snapshot_writer.hpp"
+#include "spsc_queue.hpp"
 
 #ifdef RUN_SLAM
 #include "openvslam_api.hpp"
 #endif // RUN_SLAM
 
+#ifdef RECORD_REMUX
+#include "stream_recorder.hpp"
+#endif // RECORD_REMUX
+
+/**
+* @struct VideoPipelineStats
+* @brief Snapshot of the per stage counters of the video pipeline
+*/
+struct VideoPipelineStats{
+  /** \brief Datagrams received from the drone */
+  size_t packets_received = 0;
+  /** \brief Access units assembled by the receive stage */
+  size_t frames_assembled = 0;
+  /** \brief Access units ended by the start of the next one rather than by a short datagram */
+  size_t frames_split_on_start_code = 0;
+  /** \brief Access units dropped by the receive stage as they exceeded the maximum frame size */
+  size_t frames_dropped_overflow = 0;
+  /** \brief Frame slabs allocated or grown by the receive stage */
+  size_t slab_allocations = 0;
+  /** \brief Access units waiting in the decode queue */
+  size_t decode_queue_depth = 0;
+  /** \brief Highest decode queue depth observed */
+  size_t decode_queue_max_depth = 0;
+  /** \brief Access units dropped as the decode queue was full */
+  size_t frames_dropped_queue_full = 0;
+  /** \brief Worker threads decoding the video of every drone */
+  size_t decode_workers = 0;
+  /** \brief Times a decode worker took over work queued on another worker, over every drone */
+  size_t decode_steals = 0;
+  /** \brief Frames output by the decoder */
+  size_t frames_decoded = 0;
+  /** \brief Access units that could not be decoded */
+  size_t decode_errors = 0;
+  /** \brief Frames discarded while waiting for a keyframe after data was lost */
+  size_t frames_discarded = 0;
+  /** \brief Times data was found lost and decoding stopped until the next keyframe */
+  size_t decode_gaps = 0;
+  /** \brief Keyframes requested from the drone */
+  size_t keyframe_requests = 0;
+  /** \brief Access units not decoded as no subscriber of the frame bus needed pixels */
+  size_t frames_skipped_idle = 0;
+  /** \brief Times decoding restarted from the cached keyframe rather than waiting for the next one */
+  size_t decoder_primes = 0;
+  /** \brief Cached frames decoded again to restart decoding, not published */
+  size_t frames_primed = 0;
+  /** \brief Groups of pictures that outgrew the keyframe cache */
+  size_t keyframe_cache_overflows = 0;
+  /** \brief Subscribers of the frame bus */
+  size_t frame_subscribers = 0;
+  /** \brief Image buffers allocated by the frame pools */
+  size_t frame_allocations = 0;
+  /** \brief Image buffers allocated outside the frame pools as every pooled buffer was in use */
+  size_t frame_pool_misses = 0;
+  /** \brief Snapshots saved to disk */
+  size_t snapshots_written = 0;
+  /** \brief Snapshots dropped as the snapshot queue was full */
+  size_t snapshots_dropped = 0;
+  /** \brief Frames shown in the pilot view, if shown */
+  size_t frames_displayed = 0;
+  /** \brief Frames replaced by a newer frame before the pilot view showed them */
+  size_t frames_display_skipped = 0;
+  /** \brief Rate at which the pilot view showed frames over the last second */
+  double display_fps = 0;
+};
+
+/**
+* @enum VideoStage
+* @brief Stages of the video pipeline whose latency is measured for every frame
+*/
+enum class VideoStage{
+  /** \brief First to last datagram of a frame */
+  Reassembly,
+  /** \brief Last datagram to a decode worker taking the frame */
+  DecodeQueue,
+  /** \brief Decode thread taking the frame to the parser handing it to the decoder; includes the parser waiting for the start of the next frame */
+  Parse,
+  /** \brief Frame handed to the decoder to decoded picture out */
+  Decode,
+  /** \brief Conversion of the decoded picture to the images the subscribers need, and queueing them */
+  Convert,
+  /** \brief First datagram to the frame being queued for every subscriber (display, SLAM, recording, snapshots) */
+  Handoff,
+  /** \brief First datagram to the frame being shown in the pilot view */
+  Display
+};
+
+/**
+* @struct FrameExportOptions
+* @brief Where and in which size and pixel format the decoded frames are exported to shared memory
+*/
+struct FrameExportOptions{
+  /** \brief Name of the POSIX shared memory object, eg "/tello_frames"; nothing is exported if empty; has to be unique per drone */
+  std::string shm_name;
+  /** \brief Size and pixel format of the exported frames; a width or height of 0 follows the frame */
+  FrameSpec spec;
+};
+
 /**
 * @class VideoSocket
 * @brief Class that enables video streaming from the tello and creates and manages the SLAM object if SLAM is enabled
@@ -36,6 +151,13 @@ public:
   * @param [in] load_map bool for whether the map should be loaded
   * @param [in] continue_mapping continue adding to the map even when a map has been loaded
   * @param [in] scale scale for SLAM
+  * @param [in] decoder_threads number of threads used by the H.264 decoder, 0 for one per core
+  * @param [in] decoder_thread_type whether the H.264 decoder uses frame or slice threading
+  * @param [in] converter_backend implementation of the YUV to BGR conversion
+  * @param [in] preview_spec size and pixel format of the pilot view; by default the full frame in BGR
+  * @param [in] decode_workers number of threads decoding the video of every drone, 0 for one per core; set by the first VideoSocket created
+  * @param [in] frame_export shared memory object the frames are exported to, and their size and pixel format; nothing is exported by default
+  * @param [in] show_video show the pilot view; without it and other subscribers the frames are not decoded at all
   * @return none
   */
   VideoSocket(
@@ -51,7 +173,14 @@ public:
     const std::string mask_img_path,
     bool load_map,
     bool continue_mapping,
-    float scale
+    float scale,
+    int decoder_threads = 1,
+    H264ThreadType decoder_thread_type = H264ThreadType::Slice,
+    ConverterBackend converter_backend = ConverterBackend::Auto,
+    const FrameSpec& preview_spec = FrameSpec(),
+    size_t decode_workers = 0,
+    const FrameExportOptions& frame_export = FrameExportOptions(),
+    bool show_video = true
   );
 
   /**
@@ -61,40 +190,161 @@ public:
   ~VideoSocket();
 
   /**
-  * @brief take a snapshot of the next frame
+  * @brief take a snapshot of the next frame, or of the next few frames
+  * @param [in] n_frames number of consecutive frames to save
+  * @return void
+  * @details The snapshots are saved by a background thread; frames that do
+  not fit in its queue are dropped
+  */
+  void setSnapshot(int n_frames = 1);
+
+  /**
+  * @brief set a function that makes the drone send a keyframe soon, eg by sending "streamon"
+  * @param [in] request function called from a decode worker while frames are discarded for want of a keyframe; returns whether it asked the drone, at most once a second, or is tried again with the next frame
   * @return void
+  * @details After video data is lost, frames are discarded until the next
+  keyframe arrives, which the drone only sends every so often unless asked to
+  */
+  void setKeyframeRequest(std::function<bool()> request);
+
+  /**
+  * @brief get the bus the decoded frames are published on, eg to subscribe a detector
+  * @return FrameBus& frame bus; subscriptions have to be closed before the VideoSocket is destroyed
+  */
+  FrameBus& getFrameBus();
+
+  /**
+  * @brief get the current counters of the receive and decode stages
+  * @return VideoPipelineStats snapshot of the counters
+  */
+  VideoPipelineStats getPipelineStats() const;
+
+  /**
+  * @brief get the latency percentiles of a stage of the pipeline
+  * @param [in] stage stage of the pipeline
+  * @return LatencyHistogram::Summary count, p50, p99, max and mean latency of the stage
+  */
+  LatencyHistogram::Summary getLatency(VideoStage stage) const;
+
+  /**
+  * @brief get the name of a stage, eg for logging
+  * @param [in] stage stage of the pipeline
+  * @return const char* name of the stage
   */
-  void setSnapshot();
+  static const char* stageName(VideoStage stage);
 
 private:
 
   void handleResponseFromDrone(const std::error_code& error, size_t r) override;
   void handleSendCommand(const std::error_code& error, size_t bytes_sent, std::string cmd) override;
+  void processInjectedDatagram(const unsigned char* data, size_t size) override;
 
-  void decodeFrame();
-  void takeSnapshot(cv::Mat& image);
+  unsigned char* reserveDatagram();
+  void receive();
+  void assemble(size_t bytes_recvd);
+  size_t findAccessUnitBoundary();
+  void queueFrame(size_t end);
+  bool decodePending();
+  void decodeFrame(const AccessUnit& access_unit);
+  void feedDecoder(const unsigned char* data, size_t size, int64_t pts);
+  void packetSent(int64_t pts);
+  bool checkAccessUnit(bool intact, bool is_idr);
+  bool primeDecoder();
+  void waitForIdr();
+  void idle();
+  void requestKeyframe();
+  void processFrame(const AVFrame& frame);
+  void exportFrame(const VideoFrame& frame);
+  const LatencyHistogram& latency(VideoStage stage) const;
+  LatencyHistogram& latency(VideoStage stage);
 
   enum{ max_length_ =  2048 };
-  enum{ max_length_large_ =  65536 };
+  enum{ max_payload_ = 1460 };
+  enum{ initial_frame_size_ =  65536 };
+  enum{ max_frame_size_ = 1 << 22 };
+  enum{ decode_queue_length_ = 16 };
+  enum{ decode_batch_ = 4 };
+  enum{ keyframe_request_interval_ms_ = 1000 };
+  enum{ keyframe_cache_bytes_ = 1 << 21 };
+  enum{ keyframe_cache_access_units_ = 150 };
+  enum{ snapshot_queue_length_ = 8 };
+  enum{ record_queue_length_ = 6 };
+  enum{ slam_queue_length_ = 4 };
+  enum{ shm_slots_ = 4 };
+  // Largest frame of the drone, 720p, that an exported size following the
+  // decoded frame has to hold
+  enum{ shm_max_width_ = 1280, shm_max_height_ = 720 };
   bool received_response_ = true;
 
-  char data_[max_length_];
-  char frame_buffer_[max_length_large_];
-
-  size_t first_empty_index = 0;
+  // Receive stage; only touched by the io_service thread. Datagrams are
+  // received straight into the end of the current slab, which is scanned
+  // for the start codes of NAL units from scan_pos_ on.
+  AccessUnit access_unit_;
   int frame_buffer_n_packets_ = 0;
+  size_t scan_pos_ = 0;
+  bool has_slice_ = false;
+  bool dropped_since_queued_ = false;
+
+  // Access units handed from the receive stage to the decode stage, and
+  // emptied slabs handed back for reuse
+  SPSCQueue<AccessUnit> decode_queue_;
+  SPSCQueue<FrameSlab> recycle_queue_;
+  std::shared_ptr<DecodeScheduler> scheduler_;
+  std::shared_ptr<DecodeScheduler::Lane> decode_lane_;
+
+  std::atomic<size_t> packets_received_{0}, frames_assembled_{0},
+    frames_split_on_start_code_{0}, frames_dropped_overflow_{0}, slab_allocations_{0}, decode_queue_max_depth_{0},
+    frames_dropped_queue_full_{0}, frames_decoded_{0}, decode_errors_{0},
+    frames_discarded_{0}, decode_gaps_{0}, keyframe_requests_{0}, frames_skipped_idle_{0},
+    decoder_primes_{0}, frames_primed_{0}, keyframe_cache_overflows_{0};
 
+  // Decode stage; only touched by the decode worker running the lane
+  struct AccessUnitTiming{
+    int64_t pts;
+    std::chrono::steady_clock::time_point dequeued, sent;
+  };
+  AccessUnitTiming* findTiming(int64_t pts);
+  // Access units recently given to the decoder, found again through the
+  // timestamp the decoder passes on to their packet and frame
+  std::array<AccessUnitTiming, 16> timings_{};
+  size_t next_timing_ = 0;
+  // Nothing can be decoded before the first keyframe
+  H264GapDetector gap_detector_;
+  bool waiting_for_idr_ = true;
+  // Lets decoding restart mid group of pictures, eg once a subscriber needs
+  // pixels again; the frames decoded from it are not published, including
+  // those frame threading only outputs after priming, up to primed_pts_
+  KeyframeCache keyframe_cache_;
+  bool priming_ = false;
+  int64_t primed_pts_ = AV_NOPTS_VALUE;
+  std::chrono::steady_clock::time_point last_keyframe_request_;
+  std::function<bool()> keyframe_request_;
+  std::mutex keyframe_request_mutex_;
+  // The Display stage is measured by the display
+  std::array<LatencyHistogram, static_cast<size_t>(VideoStage::Display)> latency_;
   H264Decoder decoder_;
-  ConverterRGB24 converter_;
-#ifdef RECORD
+  // Every consumer subscribes to the images it needs; each is converted once
+  // per frame
+  FrameBus bus_;
+  SnapshotWriter snapshot_writer_;
+  std::unique_ptr<FrameDisplay> display_;
+  // Only touched by the thread of the subscription
+  const FrameExportOptions frame_export_;
+  std::unique_ptr<FrameShmWriter> shm_writer_;
+  std::shared_ptr<FrameSubscription> shm_subscription_;
+  size_t shm_frames_too_large_ = 0;
+#ifdef RECORD_REMUX
+  std::unique_ptr<StreamRecorder> recorder_;
+#elif defined(RECORD)
   std::unique_ptr<cv::VideoWriter> video;
+  std::shared_ptr<FrameSubscription> record_subscription_;
 #endif
 
 #ifdef RUN_SLAM
   std::unique_ptr<OpenVSLAM_API> api_;
+  std::shared_ptr<FrameSubscription> slam_subscription_;
 #endif // RUN_SLAM
   bool& run_;
-  std::atomic<bool> snap_ = false;
 };
 
 #endif // VIDEOSOCKET_HPP
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "frame_shm.hpp"
+
+namespace {
+
+  constexpr size_t alignment = 64;
+
+  size_t alignUp(size_t n){
+    return (n + alignment - 1) & ~(alignment - 1);
+  }
+
+  size_t headerBytes(){
+    return alignUp(sizeof(frame_shm::Header));
+  }
+
+  frame_shm::Header* header(unsigned char* base){
+    return reinterpret_cast<frame_shm::Header*>(base);
+  }
+
+  const frame_shm::Header* header(const unsigned char* base){
+    return reinterpret_cast<const frame_shm::Header*>(base);
+  }
+
+  // The pixels follow the slot header
+  size_t slotOffset(const frame_shm::Header* h, uint32_t slot){
+    return headerBytes() + slot * h->slot_stride;
+  }
+
+  std::runtime_error systemError(const std::string& what, const std::string& name){
+    return std::runtime_error(what + " " + name + ": " + std::strerror(errno));
+  }
+
+  // Whether an existing object was left by a writer that no longer runs
+  bool stale(const std::string& name){
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) return false;
+    struct stat st;
+    bool left = false;
+    if(fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(frame_shm::Header)){
+      void* base = mmap(nullptr, sizeof(frame_shm::Header), PROT_READ, MAP_SHARED, fd, 0);
+      if(base != MAP_FAILED){
+        const frame_shm::Header* h = static_cast<const frame_shm::Header*>(base);
+        if(std::memcmp(h->magic, frame_shm::magic, sizeof(h->magic)) == 0 && h->version == frame_shm::version){
+          const pid_t pid = h->writer_pid.load();
+          left = h->writer_alive.load() == 0 || (kill(pid, 0) != 0 && errno == ESRCH);
+        }
+        munmap(base, sizeof(frame_shm::Header));
+      }
+    }
+    close(fd);
+    return left;
+  }
+
+  void futexWake(std::atomic<uint32_t>* word){
+#ifdef __linux__
+    // Not FUTEX_PRIVATE_FLAG; the waiters are in other processes
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+  }
+
+  void futexWait(const std::atomic<uint32_t>* word, uint32_t expected, std::chrono::microseconds timeout){
+#ifdef __linux__
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000;
+    ts.tv_nsec = (timeout.count() % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<const uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+    (void)word;
+    (void)expected;
+    std::this_thread::sleep_for(std::min(timeout, std::chrono::microseconds(100)));
+#endif
+  }
+}
+
+int64_t frame_shm::nowNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+FrameShmWriter::FrameShmWriter(const std::string& name, uint32_t n_slots, size_t slot_bytes)
+  :
+  name_(name)
+{
+  if(n_slots < 2) n_slots = 2;
+  const size_t slot_stride = alignUp(sizeof(frame_shm::Slot)) + alignUp(slot_bytes);
+  size_ = headerBytes() + n_slots * slot_stride;
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  // The object of a writer that crashed is replaced; one in use is not, eg
+  // if two drones are given the same name
+  if(fd < 0 && errno == EEXIST && stale(name_)){
+    shm_unlink(name_.c_str());
+    fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  }
+  if(fd < 0) throw systemError("Cannot create shared memory", name_);
+  if(ftruncate(fd, static_cast<off_t>(size_)) != 0){
+    close(fd);
+    shm_unlink(name_.c_str());
+    throw systemError("Cannot size shared memory", name_);
+  }
+  void* base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED){
+    shm_unlink(name_.c_str());
+    throw systemError("Cannot map shared memory", name_);
+  }
+  base_ = static_cast<unsigned char*>(base);
+
+  // ftruncate zero fills, so every slot starts out with an even sequence
+  frame_shm::Header* h = header(base_);
+  h->version = frame_shm::version;
+  h->n_slots = n_slots;
+  h->slot_bytes = slot_bytes;
+  h->slot_stride = slot_stride;
+  h->writer_alive.store(1);
+  h->writer_pid.store(getpid());
+  // Written last; readers check it before the rest of the header
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(h->magic, frame_shm::magic, sizeof(h->magic));
+}
+
+FrameShmWriter::~FrameShmWriter(){
+  frame_shm::Header* h = header(base_);
+  h->writer_alive.store(0);
+  h->frame_counter.fetch_add(1);
+  futexWake(&h->frame_counter);
+  munmap(base_, size_);
+  shm_unlink(name_.c_str());
+}
+
+bool FrameShmWriter::write(uint64_t frame_id, int64_t received_ns, uint32_t width, uint32_t height,
+  uint32_t stride, FrameShmFormat format, const unsigned char* data)
+{
+  frame_shm::Header* h = header(base_);
+  const size_t bytes = static_cast<size_t>(stride) * height;
+  if(bytes > h->slot_bytes) return false;
+
+  const uint32_t index = next_slot_;
+  next_slot_ = (next_slot_ + 1) % h->n_slots;
+  unsigned char* slot_base = base_ + slotOffset(h, index);
+  frame_shm::Slot* slot = reinterpret_cast<frame_shm::Slot*>(slot_base);
+
+  // Seqlock: odd while writing, so readers of this slot see it was torn
+  const uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->frame_id.store(frame_id, std::memory_order_relaxed);
+  slot->received_ns.store(received_ns, std::memory_order_relaxed);
+  slot->width.store(width, std::memory_order_relaxed);
+  slot->height.store(height, std::memory_order_relaxed);
+  slot->stride.store(stride, std::memory_order_relaxed);
+  slot->format.store(static_cast<uint32_t>(format), std::memory_order_relaxed);
+  slot->size.store(bytes, std::memory_order_relaxed);
+  std::memcpy(slot_base + alignUp(sizeof(frame_shm::Slot)), data, bytes);
+  slot->written_ns.store(frame_shm::nowNs(), std::memory_order_relaxed);
+
+  slot->seq.store(seq + 2, std::memory_order_release);
+
+  h->latest_slot.store(index, std::memory_order_release);
+  h->latest_id.store(frame_id, std::memory_order_release);
+  h->frame_counter.fetch_add(1, std::memory_order_release);
+  futexWake(&h->frame_counter);
+  return true;
+}
+
+size_t FrameShmWriter::slotBytes() const {
+  return header(base_)->slot_bytes;
+}
+
+FrameShmReader::FrameShmReader(const std::string& name){
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if(fd < 0) throw systemError("Cannot open shared memory", name);
+  struct stat st;
+  if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < headerBytes()){
+    close(fd);
+    throw std::runtime_error("Shared memory " + name + " is too small");
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void* base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) throw systemError("Cannot map shared memory", name);
+  base_ = static_cast<const unsigned char*>(base);
+
+  const frame_shm::Header* h = header(base_);
+  const bool understood = std::memcmp(h->magic, frame_shm::magic, sizeof(h->magic)) == 0 &&
+    h->version == frame_shm::version &&
+    headerBytes() + static_cast<size_t>(h->n_slots) * h->slot_stride <= size_;
+  if(!understood){
+    munmap(const_cast<unsigned char*>(base_), size_);
+    throw std::runtime_error("Shared memory " + name + " is not a frame ring of version " +
+      std::to_string(frame_shm::version));
+  }
+}
+
+FrameShmReader::~FrameShmReader(){
+  munmap(const_cast<unsigned char*>(base_), size_);
+}
+
+bool FrameShmReader::readSlot(uint32_t index, FrameShmView& view) const {
+  const frame_shm::Header* h = header(base_);
+  const unsigned char* slot_base = base_ + slotOffset(h, index);
+  const frame_shm::Slot* slot = reinterpret_cast<const frame_shm::Slot*>(slot_base);
+
+  const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+  if(seq == 0 || (seq & 1) != 0) return false; // Never written, or being written
+  view.frame_id = slot->frame_id.load(std::memory_order_relaxed);
+  view.received_ns = slot->received_ns.load(std::memory_order_relaxed);
+  view.written_ns = slot->written_ns.load(std::memory_order_relaxed);
+  view.width = slot->width.load(std::memory_order_relaxed);
+  view.height = slot->height.load(std::memory_order_relaxed);
+  view.stride = slot->stride.load(std::memory_order_relaxed);
+  view.format = static_cast<FrameShmFormat>(slot->format.load(std::memory_order_relaxed));
+  view.data = slot_base + alignUp(sizeof(frame_shm::Slot));
+  view.slot = index;
+  view.seq = seq;
+  return valid(view);
+}
+
+bool FrameShmReader::latest(FrameShmView& view) const {
+  const frame_shm::Header* h = header(base_);
+  // Only fails when the writer laps the reader, ie the reader was preempted
+  // for a whole ring of frames
+  for(int attempt = 0; attempt < 4; ++attempt){
+    if(h->latest_id.load(std::memory_order_acquire) == 0) return false;
+    const uint32_t index = h->latest_slot.load(std::memory_order_acquire);
+    if(index < h->n_slots && readSlot(index, view)) return true;
+  }
+  return false;
+}
+
+bool FrameShmReader::waitNext(uint64_t after_id, std::chrono::microseconds timeout, FrameShmView& view) const {
+  const frame_shm::Header* h = header(base_);
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while(true){
+    // Read before the id, so a frame written in between wakes the futex
+    const uint32_t counter = h->frame_counter.load(std::memory_order_acquire);
+    if(h->latest_id.load(std::memory_order_acquire) > after_id && latest(view) && view.frame_id > after_id){
+      return true;
+    }
+    if(h->writer_alive.load(std::memory_order_acquire) == 0) return false;
+    const auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+    if(left.count() <= 0) return false;
+    futexWait(&h->frame_counter, counter, left);
+  }
+}
+
+bool FrameShmReader::valid(const FrameShmView& view) const {
+  const frame_shm::Header* h = header(base_);
+  const frame_shm::Slot* slot = reinterpret_cast<const frame_shm::Slot*>(base_ + slotOffset(h, view.slot));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot->seq.load(std::memory_order_relaxed) == view.seq;
+}
+
+bool FrameShmReader::writerAlive() const {
+  return header(base_)->writer_alive.load(std::memory_order_acquire) != 0;
+}
@@ -0,0 +1,232 @@
+#ifndef FRAME_SHM_HPP
+#define FRAME_SHM_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+* @file frame_shm.hpp
+* @brief Ring of decoded frames in POSIX shared memory, for consumers in other processes
+* @details The writer owns a shared memory object holding a header and a
+ring of slots, each a seqlock protected frame. Readers map the object read
+only and read frames in place: a reader takes the view of a slot, uses the
+pixels and then checks the view is still valid, which fails only when the
+writer has reused the slot in the meantime. Readers never hold up the writer.
+Waiting for the next frame uses a futex on Linux, so a waiting reader wakes
+within microseconds of the frame being written. The layout has no pointers
+and only address free atomics, so every process may map it anywhere.
+*/
+
+/**
+* @enum FrameShmFormat
+* @brief Pixel format of the frames
+*/
+enum class FrameShmFormat : uint32_t{
+  /** \brief 3 bytes per pixel, blue green red */
+  BGR24 = 0,
+  /** \brief 1 byte per pixel */
+  GRAY8 = 1
+};
+
+/**
+* @struct FrameShmView
+* @brief Frame read from the ring
+* @details data points into the shared memory and is only valid while
+FrameShmReader::valid returns true for the view
+*/
+struct FrameShmView{
+  /** \brief Number of the frame given by the writer */
+  uint64_t frame_id = 0;
+  /** \brief Time the first datagram of the frame was received, steady clock (CLOCK_MONOTONIC) nanoseconds */
+  int64_t received_ns = 0;
+  /** \brief Time the frame was written, steady clock (CLOCK_MONOTONIC) nanoseconds */
+  int64_t written_ns = 0;
+  /** \brief Width in pixels */
+  uint32_t width = 0;
+  /** \brief Height in pixels */
+  uint32_t height = 0;
+  /** \brief Bytes from the start of a row to the start of the next */
+  uint32_t stride = 0;
+  /** \brief Pixel format */
+  FrameShmFormat format = FrameShmFormat::BGR24;
+  /** \brief Pixels, height rows of stride bytes */
+  const unsigned char* data = nullptr;
+
+  // Slot and sequence number the view was read at
+  uint32_t slot = 0;
+  uint64_t seq = 0;
+};
+
+namespace frame_shm{
+
+  /** \brief Identifies the layout below */
+  constexpr char magic[8] = {'T', 'E', 'L', 'L', 'O', 'S', 'H', 'M'};
+  constexpr uint32_t version = 2;
+
+  // Layout of the shared memory object: Header, then n_slots times a Slot
+  // followed by slot_bytes of pixels, each slot aligned to 64 bytes
+  struct Header{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_slots;
+    uint64_t slot_bytes;
+    uint64_t slot_stride;
+    // Id of the latest frame written, 0 before the first
+    std::atomic<uint64_t> latest_id;
+    // Slot the latest frame was written to
+    std::atomic<uint32_t> latest_slot;
+    // Bumped for every frame; waited on with a futex
+    std::atomic<uint32_t> frame_counter;
+    std::atomic<uint32_t> writer_alive;
+    // Process of the writer, to tell the object of a writer that crashed
+    // from one in use
+    std::atomic<int32_t> writer_pid;
+  };
+
+  // The fields are atomics as readers read them while the writer may write
+  // them; they are only accessed relaxed, ordered by the seqlock
+  struct Slot{
+    // Odd while the writer writes the slot
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> frame_id;
+    std::atomic<int64_t> received_ns;
+    std::atomic<int64_t> written_ns;
+    std::atomic<uint32_t> width;
+    std::atomic<uint32_t> height;
+    std::atomic<uint32_t> stride;
+    std::atomic<uint32_t> format;
+    std::atomic<uint64_t> size;
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+  static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+  static_assert(std::atomic<int32_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+  static_assert(std::atomic<int64_t>::is_always_lock_free, "Shared memory needs lock free atomics");
+
+  /**
+  * @brief get the steady clock time in nanoseconds, comparable across processes
+  * @return int64_t nanoseconds of CLOCK_MONOTONIC
+  */
+  int64_t nowNs();
+}
+
+/**
+* @class FrameShmWriter
+* @brief Creates the shared memory object and writes frames to it
+* @details Only one thread may write. The object is removed by the destructor.
+*/
+class FrameShmWriter{
+public:
+
+  /**
+  * @brief Constructor; creates the shared memory object, replacing one of the same name only if its writer no longer runs
+  * @param [in] name name of the shared memory object, eg "/tello_frames"
+  * @param [in] n_slots number of frames in the ring; readers have n_slots - 1 frame times to use a frame
+  * @param [in] slot_bytes maximum size of a frame in bytes
+  * @return none
+  * @details Throws std::runtime_error if the object cannot be created, eg as another writer uses the name
+  */
+  FrameShmWriter(const std::string& name, uint32_t n_slots, size_t slot_bytes);
+
+  /**
+  * @brief Destructor; removes the shared memory object
+  * @return none
+  */
+  ~FrameShmWriter();
+
+  FrameShmWriter(const FrameShmWriter&) = delete;
+  FrameShmWriter& operator=(const FrameShmWriter&) = delete;
+
+  /**
+  * @brief write a frame to the next slot and wake the waiting readers
+  * @param [in] frame_id number of the frame
+  * @param [in] received_ns time the frame was received, steady clock nanoseconds
+  * @param [in] width width in pixels
+  * @param [in] height height in pixels
+  * @param [in] stride bytes from the start of a row of data to the start of the next
+  * @param [in] format pixel format
+  * @param [in] data pixels, height rows of stride bytes
+  * @return bool false if the frame is larger than a slot and was not written
+  */
+  bool write(uint64_t frame_id, int64_t received_ns, uint32_t width, uint32_t height,
+    uint32_t stride, FrameShmFormat format, const unsigned char* data);
+
+  /**
+  * @brief get the maximum size of a frame in bytes
+  * @return size_t bytes per slot
+  */
+  size_t slotBytes() const;
+
+private:
+
+  const std::string name_;
+  unsigned char* base_ = nullptr;
+  size_t size_ = 0;
+  uint32_t next_slot_ = 0;
+};
+
+/**
+* @class FrameShmReader
+* @brief Maps the shared memory object of a writer and reads frames from it without copying
+*/
+class FrameShmReader{
+public:
+
+  /**
+  * @brief Constructor; maps the shared memory object read only
+  * @param [in] name name the writer created the object with
+  * @return none
+  * @details Throws std::runtime_error if there is no such object or its layout is not understood
+  */
+  explicit FrameShmReader(const std::string& name);
+
+  /**
+  * @brief Destructor; unmaps the shared memory object
+  * @return none
+  */
+  ~FrameShmReader();
+
+  FrameShmReader(const FrameShmReader&) = delete;
+  FrameShmReader& operator=(const FrameShmReader&) = delete;
+
+  /**
+  * @brief read the latest frame
+  * @param [out] view the latest frame
+  * @return bool false if no frame was written yet
+  */
+  bool latest(FrameShmView& view) const;
+
+  /**
+  * @brief wait for a frame newer than a given one and read it
+  * @param [in] after_id id of the last frame read, 0 for any frame
+  * @param [in] timeout longest time to wait
+  * @param [out] view the latest frame
+  * @return bool false if no newer frame was written before the timeout
+  */
+  bool waitNext(uint64_t after_id, std::chrono::microseconds timeout, FrameShmView& view) const;
+
+  /**
+  * @brief check the pixels of a view were not overwritten; call after using them
+  * @param [in] view view returned by latest() or waitNext()
+  * @return bool false if the writer reused the slot, in which case what was read is torn
+  */
+  bool valid(const FrameShmView& view) const;
+
+  /**
+  * @brief whether the writer still exists
+  * @return bool false once the writer was destroyed
+  */
+  bool writerAlive() const;
+
+private:
+
+  bool readSlot(uint32_t slot, FrameShmView& view) const;
+
+  const unsigned char* base_ = nullptr;
+  size_t size_ = 0;
+};
+
+#endif // FRAME_SHM_HPP
@@ -0,0 +1,289 @@
+#include "h264_nal.hpp"
+
+#include <vector>
+
+namespace {
+
+/* Reads bits from an RBSP, that is a NAL unit payload with the emulation
+prevention bytes removed. Reads past the end return zeros and set
+overrun. */
+class BitReader
+{
+public:
+  BitReader(const std::vector<uint8_t>& rbsp) : data_(rbsp) {}
+
+  uint32_t bits(int n)
+  {
+    uint32_t v = 0;
+    for (int i = 0; i < n; ++i) {
+      size_t byte = pos_ >> 3;
+      int bit = 0;
+      if (byte < data_.size())
+        bit = (data_[byte] >> (7 - (pos_ & 7))) & 1;
+      else
+        overrun = true;
+      v = (v << 1) | bit;
+      ++pos_;
+    }
+    return v;
+  }
+
+  uint32_t ue()
+  {
+    int zeros = 0;
+    while (bits(1) == 0) {
+      if (++zeros > 31 || overrun)
+        return 0;
+    }
+    return ((1u << zeros) - 1) + bits(zeros);
+  }
+
+  int32_t se()
+  {
+    uint32_t v = ue();
+    return (v & 1) ? static_cast<int32_t>((v + 1) / 2) : -static_cast<int32_t>(v / 2);
+  }
+
+  bool overrun = false;
+
+private:
+  const std::vector<uint8_t>& data_;
+  size_t pos_ = 0;
+};
+
+void skip_scaling_list(BitReader& br, int size)
+{
+  int last = 8, next = 8;
+  for (int j = 0; j < size; ++j) {
+    if (next != 0)
+      next = (last + br.se() + 256) % 256;
+    last = next == 0 ? last : next;
+  }
+}
+
+/* Copies the NAL unit payload, at most max_size bytes of it, without the
+header byte and the emulation prevention bytes (00 00 03 -> 00 00). */
+std::vector<uint8_t> to_rbsp(const uint8_t* nal, size_t size, size_t max_size)
+{
+  std::vector<uint8_t> rbsp;
+  rbsp.reserve(size < max_size ? size : max_size);
+  for (size_t i = 1; i < size && rbsp.size() < max_size; ++i) {
+    if (i >= 3 && nal[i] == 3 && nal[i - 1] == 0 && nal[i - 2] == 0)
+      continue;
+    rbsp.push_back(nal[i]);
+  }
+  return rbsp;
+}
+
+} // namespace
+
+
+size_t h264_find_start_code(const uint8_t* data, size_t size, size_t pos)
+{
+  while (pos + 3 <= size) {
+    if (data[pos + 2] > 1)
+      pos += 3;
+    else if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1)
+      return pos;
+    else
+      ++pos;
+  }
+  return size;
+}
+
+
+size_t h264_split_nal_units(const uint8_t* data, size_t size, H264NalUnit* units, size_t max_units)
+{
+  size_t n = 0;
+  size_t start = h264_find_start_code(data, size, 0);
+  while (start < size) {
+    size_t begin = start + 3;
+    size_t next = h264_find_start_code(data, size, begin);
+    size_t end = next;
+    // Zero bytes before the next start code are not part of the NAL unit
+    while (end > begin && data[end - 1] == 0)
+      --end;
+    if (end > begin) {
+      if (n < max_units)
+        units[n] = H264NalUnit{data + begin, end - begin, data[begin] & 0x1f};
+      ++n;
+    }
+    start = next;
+  }
+  return n;
+}
+
+
+bool h264_parse_sps(const uint8_t* sps, size_t size, H264SpsInfo* info)
+{
+  if (size < 4 || (sps[0] & 0x1f) != H264_NAL_SPS)
+    return false;
+
+  std::vector<uint8_t> rbsp = to_rbsp(sps, size, size);
+  BitReader br(rbsp);
+  uint32_t profile_idc = br.bits(8);
+  br.bits(16); // constraint flags and level_idc
+  br.ue();     // seq_parameter_set_id
+
+  uint32_t chroma_format_idc = 1;
+  bool separate_colour_plane = false;
+  switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83:
+    case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+      chroma_format_idc = br.ue();
+      if (chroma_format_idc == 3)
+        separate_colour_plane = br.bits(1);
+      br.ue();    // bit_depth_luma_minus8
+      br.ue();    // bit_depth_chroma_minus8
+      br.bits(1); // qpprime_y_zero_transform_bypass_flag
+      if (br.bits(1)) { // seq_scaling_matrix_present_flag
+        for (int i = 0; i < (chroma_format_idc != 3 ? 8 : 12); ++i) {
+          if (br.bits(1))
+            skip_scaling_list(br, i < 6 ? 16 : 64);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  uint32_t log2_max_frame_num = br.ue() + 4;
+  if (log2_max_frame_num > 16)
+    return false;
+  uint32_t pic_order_cnt_type = br.ue();
+  if (pic_order_cnt_type == 0) {
+    br.ue(); // log2_max_pic_order_cnt_lsb_minus4
+  }
+  else if (pic_order_cnt_type == 1) {
+    br.bits(1); // delta_pic_order_always_zero_flag
+    br.se();    // offset_for_non_ref_pic
+    br.se();    // offset_for_top_to_bottom_field
+    uint32_t n = br.ue();
+    if (n > 255)
+      return false;
+    for (uint32_t i = 0; i < n; ++i)
+      br.se();
+  }
+
+  br.ue();    // max_num_ref_frames
+  br.bits(1); // gaps_in_frame_num_value_allowed_flag
+  uint32_t width_in_mbs = br.ue() + 1;
+  uint32_t height_in_map_units = br.ue() + 1;
+  uint32_t frame_mbs_only = br.bits(1);
+  if (!frame_mbs_only)
+    br.bits(1); // mb_adaptive_frame_field_flag
+  br.bits(1);   // direct_8x8_inference_flag
+
+  uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+  if (br.bits(1)) {
+    crop_left = br.ue();
+    crop_right = br.ue();
+    crop_top = br.ue();
+    crop_bottom = br.ue();
+  }
+  if (br.overrun)
+    return false;
+
+  uint32_t crop_unit_x = 1, crop_unit_y = 2 - frame_mbs_only;
+  if (!separate_colour_plane && chroma_format_idc != 0) {
+    crop_unit_x = chroma_format_idc == 3 ? 1 : 2;
+    crop_unit_y *= chroma_format_idc == 1 ? 2 : 1;
+  }
+
+  long w = static_cast<long>(width_in_mbs) * 16 - static_cast<long>(crop_unit_x) * (crop_left + crop_right);
+  long h = static_cast<long>(2 - frame_mbs_only) * height_in_map_units * 16
+    - static_cast<long>(crop_unit_y) * (crop_top + crop_bottom);
+  if (w <= 0 || h <= 0 || w > 16384 || h > 16384)
+    return false;
+  info->width = static_cast<int>(w);
+  info->height = static_cast<int>(h);
+  info->log2_max_frame_num = static_cast<int>(log2_max_frame_num);
+  info->separate_colour_plane = separate_colour_plane;
+  return true;
+}
+
+
+bool h264_parse_sps_size(const uint8_t* sps, size_t size, int* width, int* height)
+{
+  H264SpsInfo info;
+  if (!h264_parse_sps(sps, size, &info))
+    return false;
+  *width = info.width;
+  *height = info.height;
+  return true;
+}
+
+
+bool h264_parse_slice_header(const uint8_t* slice, size_t size, const H264SpsInfo& sps,
+  int* first_mb, int* frame_num)
+{
+  if (size < 2)
+    return false;
+  // The fields needed are within the first few bytes of the header
+  std::vector<uint8_t> rbsp = to_rbsp(slice, size, 32);
+  BitReader br(rbsp);
+  uint32_t mb = br.ue(); // first_mb_in_slice
+  br.ue();               // slice_type
+  br.ue();               // pic_parameter_set_id
+  if (sps.separate_colour_plane)
+    br.bits(2);          // colour_plane_id
+  uint32_t num = br.bits(sps.log2_max_frame_num);
+  if (br.overrun)
+    return false;
+  *first_mb = static_cast<int>(mb);
+  *frame_num = static_cast<int>(num);
+  return true;
+}
+
+
+bool H264GapDetector::check(const uint8_t* data, size_t size, bool* is_idr)
+{
+  enum { max_units = 64 };
+  H264NalUnit units[max_units];
+  size_t n = h264_split_nal_units(data, size, units, max_units);
+  if (n > max_units)
+    n = max_units;
+
+  *is_idr = false;
+  bool intact = n > 0;
+  // Only zero bytes may come before the first start code
+  for (size_t i = 0; n > 0 && data + i < units[0].data - 3; ++i) {
+    if (data[i] != 0)
+      intact = false;
+  }
+
+  bool first_slice = true;
+  for (size_t i = 0; i < n; ++i) {
+    const H264NalUnit& unit = units[i];
+    if (unit.type == H264_NAL_SPS) {
+      has_sps = h264_parse_sps(unit.data, unit.size, &sps);
+    }
+    else if ((unit.type == H264_NAL_SLICE || unit.type == H264_NAL_IDR) && first_slice) {
+      first_slice = false;
+      const bool idr = unit.type == H264_NAL_IDR;
+      const bool reference = (unit.data[0] >> 5) & 3;
+      *is_idr = idr;
+      int first_mb = 0, frame_num = 0;
+      if (!has_sps || !h264_parse_slice_header(unit.data, unit.size, sps, &first_mb, &frame_num))
+        continue;
+      if (first_mb != 0)
+        intact = false;
+      if (!idr && prev_ref_frame_num >= 0) {
+        // A picture repeats the frame_num of the reference picture before
+        // it, or follows it by one
+        const int max_frame_num = 1 << sps.log2_max_frame_num;
+        if (frame_num != prev_ref_frame_num && frame_num != (prev_ref_frame_num + 1) % max_frame_num)
+          intact = false;
+      }
+      if (reference)
+        prev_ref_frame_num = frame_num;
+    }
+  }
+  return intact;
+}
+
+
+void H264GapDetector::reset()
+{
+  prev_ref_frame_num = -1;
+}
@@ -0,0 +1,83 @@
+#ifndef H264_NAL_HPP
+#define H264_NAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/* Helpers for working on an H.264 Annex-B byte stream without decoding
+it: finding start codes, classifying NAL units and reading the picture
+size from a sequence parameter set. */
+
+enum H264NalType
+{
+  H264_NAL_SLICE = 1,
+  H264_NAL_IDR = 5,
+  H264_NAL_SEI = 6,
+  H264_NAL_SPS = 7,
+  H264_NAL_PPS = 8,
+  H264_NAL_AUD = 9
+};
+
+struct H264NalUnit
+{
+  /* Points at the NAL header byte, after the start code. */
+  const uint8_t* data;
+  /* Size without the start code. */
+  size_t size;
+  int type;
+};
+
+/* Returns the offset of the first 00 00 01 start code at or after pos,
+or size if there is none. A four byte start code is found at its
+last three bytes. */
+size_t h264_find_start_code(const uint8_t* data, size_t size, size_t pos);
+
+/* Splits an Annex-B buffer into NAL units. Returns the number of units
+found, writing at most max_units of them to units. Bytes before the first
+start code are ignored. */
+size_t h264_split_nal_units(const uint8_t* data, size_t size, H264NalUnit* units, size_t max_units);
+
+/* Fields of a sequence parameter set needed to read slice headers. */
+struct H264SpsInfo
+{
+  int width;
+  int height;
+  int log2_max_frame_num;
+  bool separate_colour_plane;
+};
+
+/* Parses an SPS NAL unit (header byte included). Returns false if the
+SPS is truncated or malformed. */
+bool h264_parse_sps(const uint8_t* sps, size_t size, H264SpsInfo* info);
+
+/* Reads the cropped picture size from an SPS NAL unit (header byte
+included). Returns false if the SPS is truncated or malformed. */
+bool h264_parse_sps_size(const uint8_t* sps, size_t size, int* width, int* height);
+
+/* Reads first_mb_in_slice and frame_num from the header of a slice NAL
+unit (header byte included). Returns false if it is truncated. */
+bool h264_parse_slice_header(const uint8_t* slice, size_t size, const H264SpsInfo& sps,
+  int* first_mb, int* frame_num);
+
+/* Detects pictures lost from a stream, one access unit at a time, by
+following frame_num from one reference picture to the next. An access
+unit is also reported as damaged if its start is missing: data before
+the first start code, or a first slice that does not start the picture. */
+class H264GapDetector
+{
+public:
+  /* Returns false if pictures were lost before the access unit or the
+access unit is damaged. Sets is_idr if it holds an IDR slice, after
+which decoding can restart. */
+  bool check(const uint8_t* data, size_t size, bool* is_idr);
+  /* Forgets the frame_num of the last reference picture, eg after
+access units were dropped without being checked. */
+  void reset();
+
+private:
+  H264SpsInfo sps;
+  bool has_sps = false;
+  int prev_ref_frame_num = -1;
+};
+
+#endif // H264_NAL_HPP
@@ -20,6 +20,8 @@ extern "C" {
 #endif
 
 #include "h264decoder.hpp"
+#include "yuv2bgr.hpp"
+#include <cstring>
 #include <utility>
 
 typedef unsigned char ubyte;
@@ -31,7 +33,7 @@ typedef unsigned char ubyte;
 #endif
 
 
-H264Decoder::H264Decoder()
+H264Decoder::H264Decoder(int thread_count, H264ThreadType thread_type)
 {
   avcodec_register_all();
 
@@ -47,6 +49,9 @@ H264Decoder::H264Decoder()
     context->flags |= CODEC_FLAG_TRUNCATED;
   }
 
+  context->thread_count = thread_count;
+  context->thread_type = thread_type == H264ThreadType::Frame ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+
   int err = avcodec_open2(context, codec, nullptr);
   if (err < 0)
     throw H264InitFailure("cannot open context");
@@ -81,36 +86,132 @@ H264Decoder::~H264Decoder()
 
 
 ssize_t H264Decoder::parse(const ubyte* in_data, ssize_t in_size)
+{
+  return parse(in_data, in_size, AV_NOPTS_VALUE);
+}
+
+
+ssize_t H264Decoder::parse(const ubyte* in_data, ssize_t in_size, int64_t pts)
 {
   auto nread = av_parser_parse2(parser, context, &pkt->data, &pkt->size,
     in_data, in_size,
-    0, 0, AV_NOPTS_VALUE);
+    pts, AV_NOPTS_VALUE, 0);
+  pkt->pts = parser->pts;
   return nread;
 }
 
 
+int64_t H264Decoder::packet_pts() const
+{
+  return pkt->pts;
+}
+
+
 bool H264Decoder::is_frame_available() const
 {
   return pkt->size > 0;
 }
 
 
+bool H264Decoder::send_packet()
+{
+  int err = avcodec_send_packet(context, pkt);
+  if (err == AVERROR(EAGAIN))
+    return false;
+  if (err < 0)
+    throw H264DecodeFailure("error sending packet to decoder\n");
+  return true;
+}
+
+
+const AVFrame* H264Decoder::receive_frame()
+{
+  int err = avcodec_receive_frame(context, frame);
+  if (err == AVERROR(EAGAIN) || err == AVERROR_EOF)
+    return nullptr;
+  if (err < 0)
+    throw H264DecodeFailure("error decoding frame\n");
+  return frame;
+}
+
+
 const AVFrame& H264Decoder::decode_frame()
 {
-  int got_picture = 0;
-  int nread = avcodec_decode_video2(context, frame, &got_picture, pkt);
-  if (nread < 0 || got_picture == 0)
+  if (!send_packet() || receive_frame() == nullptr)
     throw H264DecodeFailure("error decoding frame\n");
   return *frame;
 }
 
 
-ConverterRGB24::ConverterRGB24()
+void H264Decoder::reset()
+{
+  // The parser has no flush of its own
+  av_parser_close(parser);
+  parser = av_parser_init(AV_CODEC_ID_H264);
+  if (!parser)
+    throw H264InitFailure("cannot init parser");
+  avcodec_flush_buffers(context);
+  pkt->data = nullptr;
+  pkt->size = 0;
+}
+
+
+static YUV2BGRKernel to_kernel(ConverterBackend backend)
+{
+  switch (backend) {
+    case ConverterBackend::SSE4:
+      return YUV2BGRKernel::SSE4;
+    case ConverterBackend::AVX2:
+      return YUV2BGRKernel::AVX2;
+    default:
+      return YUV2BGRKernel::Scalar;
+  }
+}
+
+
+static ConverterBackend to_backend(YUV2BGRKernel kernel)
+{
+  switch (kernel) {
+    case YUV2BGRKernel::SSE4:
+      return ConverterBackend::SSE4;
+    case YUV2BGRKernel::AVX2:
+      return ConverterBackend::AVX2;
+    default:
+      return ConverterBackend::Scalar;
+  }
+}
+
+
+ConverterRGB24::ConverterRGB24(ConverterBackend backend_)
 {
   framergb = av_frame_alloc();
   if (!framergb)
     throw H264DecodeFailure("cannot allocate frame");
   context = nullptr;
+
+  backend = backend_;
+  if (backend == ConverterBackend::Auto ||
+      (backend != ConverterBackend::Swscale && !yuv2bgr_kernel_supported(to_kernel(backend))))
+    backend = to_backend(best_yuv2bgr_kernel());
+}
+
+
+ConverterBackend ConverterRGB24::get_backend() const
+{
+  return backend;
+}
+
+
+const char* ConverterRGB24::backend_name(ConverterBackend backend)
+{
+  switch (backend) {
+    case ConverterBackend::Swscale:
+      return "swscale";
+    case ConverterBackend::Auto:
+      return "auto";
+    default:
+      return yuv2bgr_kernel_name(to_kernel(backend));
+  }
 }
 
 ConverterRGB24::~ConverterRGB24()
@@ -126,18 +227,30 @@ const AVFrame& ConverterRGB24::convert(const AVFrame &frame, ubyte* out_rgb)
   int h = frame.height;
   int pix_fmt = frame.format;
 
-  context = sws_getCachedContext(context,
-    w, h, (AVPixelFormat)pix_fmt,
-    w, h, AV_PIX_FMT_BGR24, SWS_BILINEAR,
-    nullptr, nullptr, nullptr);
-  if (!context)
-    throw H264DecodeFailure("cannot allocate context");
-
   // Setup framergb with out_rgb as external buffer. Also say that we want RGB24 output.
   avpicture_fill((AVPicture*)framergb, out_rgb, AV_PIX_FMT_BGR24, w, h);
-  // Do the conversion.
-  sws_scale(context, frame.data, frame.linesize, 0, h,
-    framergb->data, framergb->linesize);
+
+  if (backend != ConverterBackend::Swscale &&
+      (pix_fmt == AV_PIX_FMT_YUV420P || pix_fmt == AV_PIX_FMT_YUVJ420P)) {
+    yuv420p_to_bgr24(to_kernel(backend),
+      frame.data[0], frame.linesize[0],
+      frame.data[1], frame.linesize[1],
+      frame.data[2], frame.linesize[2],
+      framergb->data[0], framergb->linesize[0],
+      w, h, pix_fmt == AV_PIX_FMT_YUVJ420P);
+  }
+  else {
+    context = sws_getCachedContext(context,
+      w, h, (AVPixelFormat)pix_fmt,
+      w, h, AV_PIX_FMT_BGR24, SWS_BILINEAR,
+      nullptr, nullptr, nullptr);
+    if (!context)
+      throw H264DecodeFailure("cannot allocate context");
+
+    // Do the conversion.
+    sws_scale(context, frame.data, frame.linesize, 0, h,
+      framergb->data, framergb->linesize);
+  }
   framergb->width = w;
   framergb->height = h;
   return *framergb;
@@ -158,6 +271,120 @@ int ConverterRGB24::predict_size(int w, int h)
 
 
 
+static bool is_planar_yuv(int pix_fmt)
+{
+  switch (pix_fmt) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+ConverterGray8::ConverterGray8()
+{
+  context = nullptr;
+}
+
+ConverterGray8::~ConverterGray8()
+{
+  sws_freeContext(context);
+}
+
+
+int ConverterGray8::predict_size(int w, int h)
+{
+  return w * h;
+}
+
+
+void ConverterGray8::convert(const AVFrame &frame, ubyte* out_gray)
+{
+  int w = frame.width;
+  int h = frame.height;
+
+  int linesize = 0;
+  const ubyte* y = luma(frame, &linesize);
+  if (y) {
+    if (linesize == w) {
+      memcpy(out_gray, y, static_cast<size_t>(w) * h);
+    }
+    else {
+      for (int row = 0; row < h; ++row)
+        memcpy(out_gray + static_cast<size_t>(row) * w, y + static_cast<size_t>(row) * linesize, w);
+    }
+    return;
+  }
+
+  context = sws_getCachedContext(context,
+    w, h, (AVPixelFormat)frame.format,
+    w, h, AV_PIX_FMT_GRAY8, SWS_BILINEAR,
+    nullptr, nullptr, nullptr);
+  if (!context)
+    throw H264DecodeFailure("cannot allocate context");
+
+  ubyte* dst[1] = { out_gray };
+  int dst_linesize[1] = { w };
+  sws_scale(context, frame.data, frame.linesize, 0, h, dst, dst_linesize);
+}
+
+
+const ubyte* ConverterGray8::luma(const AVFrame &frame, int *linesize)
+{
+  if (!is_planar_yuv(frame.format))
+    return nullptr;
+  *linesize = frame.linesize[0];
+  return frame.data[0];
+}
+
+
+ConverterScaled::ConverterScaled()
+{
+  context = nullptr;
+}
+
+ConverterScaled::~ConverterScaled()
+{
+  sws_freeContext(context);
+}
+
+
+int ConverterScaled::bytes_per_pixel(OutputFormat format)
+{
+  return format == OutputFormat::GRAY8 ? 1 : 3;
+}
+
+
+int ConverterScaled::predict_size(int w, int h, OutputFormat format)
+{
+  return w * h * bytes_per_pixel(format);
+}
+
+
+void ConverterScaled::convert(const AVFrame &frame, int out_w, int out_h, OutputFormat format, ubyte* out)
+{
+  const AVPixelFormat out_fmt = format == OutputFormat::GRAY8 ? AV_PIX_FMT_GRAY8 : AV_PIX_FMT_BGR24;
+  // Area averaging does not alias when shrinking, at a cost close to bilinear
+  const int flags = (out_w < frame.width || out_h < frame.height) ? SWS_AREA : SWS_BILINEAR;
+  context = sws_getCachedContext(context,
+    frame.width, frame.height, (AVPixelFormat)frame.format,
+    out_w, out_h, out_fmt, flags,
+    nullptr, nullptr, nullptr);
+  if (!context)
+    throw H264DecodeFailure("cannot allocate context");
+
+  ubyte* dst[1] = { out };
+  int dst_linesize[1] = { out_w * bytes_per_pixel(format) };
+  sws_scale(context, frame.data, frame.linesize, 0, frame.height, dst, dst_linesize);
+}
+
+
 std::pair<int, int> width_height(const AVFrame& f)
 {
   return std::make_pair(f.width, f.height);
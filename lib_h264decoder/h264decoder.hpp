@@ -1,5 +1,9 @@
 // From: https://github.com/DaWelter/h264decode
 
+#ifndef H264DECODER_HPP
+#define H264DECODER_HPP
+
+#include <cstdint>
 #include <cstdlib>
 #include <stdexcept>
 
@@ -30,6 +34,16 @@ public:
 };
 
 
+/* Threading used inside libavcodec. Frame threading scales best with
+the number of cores but delays every frame by thread_count - 1 frames;
+slice threading adds no delay but only helps when the encoder emits
+several slices per frame. */
+enum class H264ThreadType
+{
+  Frame,
+  Slice
+};
+
 class H264Decoder
 {
   /* Persistent things here, using RAII for cleanup. */
@@ -44,17 +58,52 @@ parse- and decode frame. In release 11 it is put on the stack, too.
   */
   AVPacket              *pkt;
 public:
-  H264Decoder();
+  /* thread_count 0 lets libavcodec pick one thread per core. */
+  H264Decoder(int thread_count = 1, H264ThreadType thread_type = H264ThreadType::Slice);
   ~H264Decoder();
   /* First, parse a continuous data stream, dividing it into
-packets. When there is enough data to form a new frame, decode
-the data and return the frame. parse returns the number
-of consumed bytes of the input stream. It stops consuming
-bytes at frame boundaries.
+packets. When there is enough data to form a new frame, send
+the packet to the decoder and receive all frames that are ready.
+parse returns the number of consumed bytes of the input stream.
+It stops consuming bytes at frame boundaries.
   */
   ssize_t parse(const unsigned char* in_data, ssize_t in_size);
+  /* As above, tagging the input with a timestamp. The parser hands
+it on to the packet of the frame that starts in this input, and the
+decoder on to the decoded frame (AVFrame::pts). */
+  ssize_t parse(const unsigned char* in_data, ssize_t in_size, int64_t pts);
   bool is_frame_available() const;
+  /* Timestamp of the parsed packet, AV_NOPTS_VALUE if none. */
+  int64_t packet_pts() const;
+  /* Sends the parsed packet to the decoder. Returns false if the
+decoder cannot accept it before the pending frames are received,
+in which case it has to be sent again. Throws H264DecodeFailure
+on errors. */
+  bool send_packet();
+  /* Returns the next decoded frame, or nullptr once the decoder
+needs more input. The frame stays valid until the next call. With
+frame threading a single packet can yield zero or several frames. */
+  const AVFrame* receive_frame();
+  /* Sends the parsed packet and returns the first frame it yields.
+Throws H264DecodeFailure if no frame is ready. */
   const AVFrame& decode_frame();
+  /* Drops the data buffered in the parser and the frames pending in the
+decoder, eg to restart decoding at the next keyframe after data was
+lost. Throws H264InitFailure if the parser cannot be recreated. */
+  void reset();
+};
+
+/* Implementation used by ConverterRGB24 for YUV420P frames. Auto picks
+the fastest kernel of yuv2bgr.hpp the CPU supports; a kernel the CPU does
+not support is replaced by the fastest one it does. Other pixel formats
+are always converted with swscale. */
+enum class ConverterBackend
+{
+  Swscale,
+  Scalar,
+  SSE4,
+  AVX2,
+  Auto
 };
 
 // TODO: Rename to OutputStage or so?!
@@ -62,11 +111,16 @@ class ConverterRGB24
 {
   SwsContext *context;
   AVFrame *framergb;
+  ConverterBackend backend;
 
 public:
-  ConverterRGB24();
+  ConverterRGB24(ConverterBackend backend = ConverterBackend::Swscale);
   ~ConverterRGB24();
 
+  /*  Returns the backend in use, never Auto. */
+  ConverterBackend get_backend() const;
+  static const char* backend_name(ConverterBackend backend);
+
   /*  Returns, given a width and height,
       how many bytes the frame buffer is going to need. */
   int predict_size(int w, int h);
@@ -77,8 +131,64 @@ bytes in a row and so on. */
   const AVFrame& convert(const AVFrame &frame, unsigned char* out_rgb);
 };
 
+/* Extracts the grayscale image of a decoded frame. For the planar YUV
+formats H.264 decodes to this is the luma plane, so no colour conversion
+is done. Note that for limited range YUV the luma plane keeps its 16-235
+range rather than being stretched to 0-255 as a BGR to gray conversion
+would. */
+class ConverterGray8
+{
+  SwsContext *context;
+
+public:
+  ConverterGray8();
+  ~ConverterGray8();
+
+  /*  Returns, given a width and height,
+      how many bytes the frame buffer is going to need. */
+  int predict_size(int w, int h);
+  /*  Copies the grayscale image of the frame into out_gray, one row
+of frame.width bytes after another. Frames that are not planar YUV
+are converted with swscale. */
+  void convert(const AVFrame &frame, unsigned char* out_gray);
+  /*  Zero copy access to the luma plane of a planar YUV frame. Returns
+nullptr for other formats. The data is only valid until the decoder
+outputs the next frame. */
+  static const unsigned char* luma(const AVFrame &frame, int *linesize);
+};
+
+/* Pixel formats of the images ConverterScaled outputs. */
+enum class OutputFormat
+{
+  BGR24,
+  GRAY8
+};
+
+/* Converts a decoded frame to a BGR or grayscale image of another size,
+scaling and converting the colours in a single swscale pass. Meant for
+previews and other consumers that need less than the full frame; full size
+images are converted faster by ConverterRGB24 and ConverterGray8. */
+class ConverterScaled
+{
+  SwsContext *context;
+
+public:
+  ConverterScaled();
+  ~ConverterScaled();
+
+  static int bytes_per_pixel(OutputFormat format);
+  /*  Returns, given a width, height and format,
+      how many bytes the image buffer is going to need. */
+  static int predict_size(int w, int h, OutputFormat format);
+  /*  Scales the frame to out_w x out_h and fills out with the result,
+one row of out_w * bytes_per_pixel(format) bytes after another. */
+  void convert(const AVFrame &frame, int out_w, int out_h, OutputFormat format, unsigned char* out);
+};
+
 void disable_logging();
 
 /* Wrappers, so we don't have to include libav headers. */
 std::pair<int, int> width_height(const AVFrame&);
 int row_size(const AVFrame&);
+
+#endif // H264DECODER_HPP
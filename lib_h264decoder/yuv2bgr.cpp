@@ -0,0 +1,286 @@
+#include <cstddef>
+
+#include "yuv2bgr.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV2BGR_X86
+#include <immintrin.h>
+#endif
+
+/*
+All kernels do the same 16 bit fixed point arithmetic, so the vectorised
+ones are bit exact with the scalar one:
+  luma   = mulhrs((Y - y_offset) << 7, y_gain)
+  chroma = mulhrs((C - 128) << 7, k)
+where mulhrs(a, k) = (a * k + 2^14) >> 15 matches _mm_mulhrs_epi16. With
+k = coefficient * 2^14 the terms carry 6 fractional bits. The blue
+coefficient of U does not fit in 16 bits, so it is split into
+1 + (coefficient - 1), the 1 being an exact shift. Every addition
+saturates like _mm_adds_epi16.
+*/
+
+namespace {
+
+struct Coefficients
+{
+  int16_t y_offset, y_gain, v_to_r, u_to_g, v_to_g, u_to_b_minus_one;
+};
+
+// BT.601, Y in 16-235 and CbCr in 16-240
+constexpr Coefficients limited_range{16, 19077, 26149, 6419, 13320, 16666};
+// BT.601, full 0-255 range as output by yuvj420p
+constexpr Coefficients full_range{0, 16384, 22970, 5638, 11700, 12648};
+
+inline int16_t sat16(int v)
+{
+  return static_cast<int16_t>(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+}
+
+inline int16_t mulhrs(int16_t a, int16_t k)
+{
+  return static_cast<int16_t>((static_cast<int>(a) * k + 0x4000) >> 15);
+}
+
+inline uint8_t to_byte(int16_t v)
+{
+  int x = sat16(v + 32) >> 6;
+  return static_cast<uint8_t>(x > 255 ? 255 : (x < 0 ? 0 : x));
+}
+
+void row_scalar(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+  uint8_t* bgr, int x, int width, const Coefficients& c)
+{
+  for (; x < width; ++x) {
+    int16_t cu = static_cast<int16_t>((u[x / 2] - 128) << 7);
+    int16_t cv = static_cast<int16_t>((v[x / 2] - 128) << 7);
+    int16_t r_c = mulhrs(cv, c.v_to_r);
+    int16_t g_c = sat16(mulhrs(cu, c.u_to_g) + mulhrs(cv, c.v_to_g));
+    int16_t b_c = sat16(mulhrs(cu, c.u_to_b_minus_one) + (cu >> 1));
+    int16_t yy = mulhrs(static_cast<int16_t>((y[x] - c.y_offset) << 7), c.y_gain);
+    bgr[3 * x] = to_byte(sat16(yy + b_c));
+    bgr[3 * x + 1] = to_byte(sat16(yy - g_c));
+    bgr[3 * x + 2] = to_byte(sat16(yy + r_c));
+  }
+}
+
+#ifdef YUV2BGR_X86
+
+// pshufb masks interleaving 16 B, 16 G and 16 R bytes into 48 BGR bytes
+struct ShuffleMasks
+{
+  uint8_t m[3][3][16]; // [output block][channel][byte]
+};
+
+constexpr ShuffleMasks make_shuffle_masks()
+{
+  ShuffleMasks s{};
+  for (int block = 0; block < 3; ++block)
+    for (int i = 0; i < 16; ++i)
+      for (int channel = 0; channel < 3; ++channel) {
+        int k = 16 * block + i;
+        s.m[block][channel][i] = static_cast<uint8_t>(k % 3 == channel ? k / 3 : 0x80);
+      }
+  return s;
+}
+
+alignas(16) constexpr ShuffleMasks shuffle_masks = make_shuffle_masks();
+
+__attribute__((target("ssse3")))
+inline void store_bgr(uint8_t* out, __m128i b, __m128i g, __m128i r)
+{
+  for (int block = 0; block < 3; ++block) {
+    const auto* m = shuffle_masks.m[block];
+    __m128i v = _mm_or_si128(
+      _mm_or_si128(
+        _mm_shuffle_epi8(b, _mm_load_si128(reinterpret_cast<const __m128i*>(m[0]))),
+        _mm_shuffle_epi8(g, _mm_load_si128(reinterpret_cast<const __m128i*>(m[1])))),
+      _mm_shuffle_epi8(r, _mm_load_si128(reinterpret_cast<const __m128i*>(m[2]))));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * block), v);
+  }
+}
+
+// Adds (or subtracts) the duplicated chroma term of 8 chroma samples to the
+// luma of 16 pixels and packs the result to bytes
+template <bool Subtract>
+__attribute__((target("sse4.1,ssse3")))
+inline __m128i channel_sse4(__m128i y_lo, __m128i y_hi, __m128i chroma)
+{
+  const __m128i round = _mm_set1_epi16(32);
+  __m128i c_lo = _mm_unpacklo_epi16(chroma, chroma);
+  __m128i c_hi = _mm_unpackhi_epi16(chroma, chroma);
+  __m128i lo = Subtract ? _mm_subs_epi16(y_lo, c_lo) : _mm_adds_epi16(y_lo, c_lo);
+  __m128i hi = Subtract ? _mm_subs_epi16(y_hi, c_hi) : _mm_adds_epi16(y_hi, c_hi);
+  lo = _mm_srai_epi16(_mm_adds_epi16(lo, round), 6);
+  hi = _mm_srai_epi16(_mm_adds_epi16(hi, round), 6);
+  return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("sse4.1,ssse3")))
+void row_sse4(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+  uint8_t* bgr, int width, const Coefficients& c)
+{
+  const __m128i c128 = _mm_set1_epi16(128);
+  const __m128i y_offset = _mm_set1_epi16(c.y_offset);
+  const __m128i y_gain = _mm_set1_epi16(c.y_gain);
+  const __m128i v_to_r = _mm_set1_epi16(c.v_to_r);
+  const __m128i u_to_g = _mm_set1_epi16(c.u_to_g);
+  const __m128i v_to_g = _mm_set1_epi16(c.v_to_g);
+  const __m128i u_to_b = _mm_set1_epi16(c.u_to_b_minus_one);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+    __m128i u16 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2)));
+    __m128i v16 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2)));
+
+    // Chroma terms for 8 chroma samples, then duplicated for 16 pixels
+    __m128i cu = _mm_slli_epi16(_mm_sub_epi16(u16, c128), 7);
+    __m128i cv = _mm_slli_epi16(_mm_sub_epi16(v16, c128), 7);
+    __m128i r_c = _mm_mulhrs_epi16(cv, v_to_r);
+    __m128i g_c = _mm_adds_epi16(_mm_mulhrs_epi16(cu, u_to_g), _mm_mulhrs_epi16(cv, v_to_g));
+    __m128i b_c = _mm_adds_epi16(_mm_mulhrs_epi16(cu, u_to_b), _mm_srai_epi16(cu, 1));
+
+    __m128i y_lo = _mm_cvtepu8_epi16(y8);
+    __m128i y_hi = _mm_cvtepu8_epi16(_mm_srli_si128(y8, 8));
+    y_lo = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y_lo, y_offset), 7), y_gain);
+    y_hi = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(y_hi, y_offset), 7), y_gain);
+
+    store_bgr(bgr + 3 * x,
+      channel_sse4<false>(y_lo, y_hi, b_c),
+      channel_sse4<true>(y_lo, y_hi, g_c),
+      channel_sse4<false>(y_lo, y_hi, r_c));
+  }
+  row_scalar(y, u, v, bgr, x, width, c);
+}
+
+// As channel_sse4 for 16 chroma samples and 32 pixels
+template <bool Subtract>
+__attribute__((target("avx2")))
+inline __m256i channel_avx2(__m256i y_lo, __m256i y_hi, __m256i chroma)
+{
+  const __m256i round = _mm256_set1_epi16(32);
+  // unpack works within 128 bit lanes, so first order the 64 bit
+  // blocks such that the low halves hold pixels 0-15
+  __m256i ordered = _mm256_permute4x64_epi64(chroma, 0xD8);
+  __m256i c_lo = _mm256_unpacklo_epi16(ordered, ordered);
+  __m256i c_hi = _mm256_unpackhi_epi16(ordered, ordered);
+  __m256i lo = Subtract ? _mm256_subs_epi16(y_lo, c_lo) : _mm256_adds_epi16(y_lo, c_lo);
+  __m256i hi = Subtract ? _mm256_subs_epi16(y_hi, c_hi) : _mm256_adds_epi16(y_hi, c_hi);
+  lo = _mm256_srai_epi16(_mm256_adds_epi16(lo, round), 6);
+  hi = _mm256_srai_epi16(_mm256_adds_epi16(hi, round), 6);
+  return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+__attribute__((target("avx2")))
+void row_avx2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+  uint8_t* bgr, int width, const Coefficients& c)
+{
+  const __m256i c128 = _mm256_set1_epi16(128);
+  const __m256i y_offset = _mm256_set1_epi16(c.y_offset);
+  const __m256i y_gain = _mm256_set1_epi16(c.y_gain);
+  const __m256i v_to_r = _mm256_set1_epi16(c.v_to_r);
+  const __m256i u_to_g = _mm256_set1_epi16(c.u_to_g);
+  const __m256i v_to_g = _mm256_set1_epi16(c.v_to_g);
+  const __m256i u_to_b = _mm256_set1_epi16(c.u_to_b_minus_one);
+
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i y8 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+    __m256i u16 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x / 2)));
+    __m256i v16 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x / 2)));
+
+    __m256i cu = _mm256_slli_epi16(_mm256_sub_epi16(u16, c128), 7);
+    __m256i cv = _mm256_slli_epi16(_mm256_sub_epi16(v16, c128), 7);
+    __m256i r_c = _mm256_mulhrs_epi16(cv, v_to_r);
+    __m256i g_c = _mm256_adds_epi16(_mm256_mulhrs_epi16(cu, u_to_g), _mm256_mulhrs_epi16(cv, v_to_g));
+    __m256i b_c = _mm256_adds_epi16(_mm256_mulhrs_epi16(cu, u_to_b), _mm256_srai_epi16(cu, 1));
+
+    __m256i y_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(y8));
+    __m256i y_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(y8, 1));
+    y_lo = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y_lo, y_offset), 7), y_gain);
+    y_hi = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y_hi, y_offset), 7), y_gain);
+
+    __m256i b = channel_avx2<false>(y_lo, y_hi, b_c);
+    __m256i g = channel_avx2<true>(y_lo, y_hi, g_c);
+    __m256i r = channel_avx2<false>(y_lo, y_hi, r_c);
+    store_bgr(bgr + 3 * x,
+      _mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r));
+    store_bgr(bgr + 3 * x + 48,
+      _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1));
+  }
+  row_scalar(y, u, v, bgr, x, width, c);
+}
+
+#endif // YUV2BGR_X86
+
+} // namespace
+
+
+bool yuv2bgr_kernel_supported(YUV2BGRKernel kernel)
+{
+  switch (kernel) {
+    case YUV2BGRKernel::Scalar:
+      return true;
+#ifdef YUV2BGR_X86
+    case YUV2BGRKernel::SSE4:
+      return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+    case YUV2BGRKernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+
+YUV2BGRKernel best_yuv2bgr_kernel()
+{
+  if (yuv2bgr_kernel_supported(YUV2BGRKernel::AVX2))
+    return YUV2BGRKernel::AVX2;
+  if (yuv2bgr_kernel_supported(YUV2BGRKernel::SSE4))
+    return YUV2BGRKernel::SSE4;
+  return YUV2BGRKernel::Scalar;
+}
+
+
+const char* yuv2bgr_kernel_name(YUV2BGRKernel kernel)
+{
+  switch (kernel) {
+    case YUV2BGRKernel::SSE4:
+      return "sse4";
+    case YUV2BGRKernel::AVX2:
+      return "avx2";
+    default:
+      return "scalar";
+  }
+}
+
+
+void yuv420p_to_bgr24(YUV2BGRKernel kernel,
+  const uint8_t* y, int y_stride,
+  const uint8_t* u, int u_stride,
+  const uint8_t* v, int v_stride,
+  uint8_t* bgr, int bgr_stride,
+  int width, int height, bool full)
+{
+  const Coefficients& c = full ? full_range : limited_range;
+  for (int row = 0; row < height; ++row) {
+    const uint8_t* y_row = y + static_cast<ptrdiff_t>(row) * y_stride;
+    const uint8_t* u_row = u + static_cast<ptrdiff_t>(row / 2) * u_stride;
+    const uint8_t* v_row = v + static_cast<ptrdiff_t>(row / 2) * v_stride;
+    uint8_t* out = bgr + static_cast<ptrdiff_t>(row) * bgr_stride;
+    switch (kernel) {
+#ifdef YUV2BGR_X86
+      case YUV2BGRKernel::AVX2:
+        row_avx2(y_row, u_row, v_row, out, width, c);
+        break;
+      case YUV2BGRKernel::SSE4:
+        row_sse4(y_row, u_row, v_row, out, width, c);
+        break;
+#endif
+      default:
+        row_scalar(y_row, u_row, v_row, out, 0, width, c);
+        break;
+    }
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef YUV2BGR_HPP
+#define YUV2BGR_HPP
+
+#include <cstdint>
+
+/* Implementations of the YUV420P to BGR24 conversion. The vectorised
+kernels produce exactly the same output as the scalar one; all of them
+use nearest neighbour chroma upsampling and BT.601 coefficients in 6 bit
+fixed point, staying within a few levels of swscale. */
+enum class YUV2BGRKernel
+{
+  Scalar,
+  SSE4,
+  AVX2
+};
+
+/* Whether the CPU the code runs on supports the kernel. */
+bool yuv2bgr_kernel_supported(YUV2BGRKernel kernel);
+
+/* Returns the fastest kernel supported by the CPU. */
+YUV2BGRKernel best_yuv2bgr_kernel();
+
+const char* yuv2bgr_kernel_name(YUV2BGRKernel kernel);
+
+/* Converts a YUV420P frame to packed BGR24. full_range selects the
+JPEG (yuvj420p) range instead of the limited MPEG range. The kernel
+must be supported by the CPU. */
+void yuv420p_to_bgr24(YUV2BGRKernel kernel,
+  const uint8_t* y, int y_stride,
+  const uint8_t* u, int u_stride,
+  const uint8_t* v, int v_stride,
+  uint8_t* bgr, int bgr_stride,
+  int width, int height, bool full_range);
+
+#endif // YUV2BGR_HPP
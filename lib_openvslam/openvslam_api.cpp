@@ -99,9 +99,9 @@ std::mutex& OpenVSLAM_API::getMutex(){
   return pangolin_viewer::frame_display_sync;
 }
 void OpenVSLAM_API::impl::addFrameToQueue(cv::Mat new_frame){
+  std::unique_lock<std::mutex> lk(frame_m);
   if(frame_queue.size() < 3){
-    std::unique_lock<std::mutex> lk(frame_m);
-    frame_queue.push(new_frame.clone());
+    frame_queue.push(new_frame);
   }
 }
 
@@ -49,6 +49,7 @@ public:
   * @brief add frame to queue for frames to be processed for SLAM
   * @param [in] new_frame input image
   * @return void
+  * @details The image is not copied; the caller must not write to it once it has been added
   */
   void addFrameToQueue(cv::Mat new_frame);
 
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "latency_histogram.hpp"
+
+LatencyHistogram::LatencyHistogram(){
+  reset();
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value){
+  if(value < sub_buckets_) return value;
+  // Position of the highest set bit, at least 3 here
+  const int exponent = 63 - __builtin_clzll(value);
+  const size_t sub_bucket = (value >> (exponent - 3)) & (sub_buckets_ - 1);
+  return (exponent - 2) * sub_buckets_ + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucketUpperEdge(size_t index){
+  if(index < sub_buckets_) return index;
+  const int exponent = static_cast<int>(index / sub_buckets_) + 2;
+  const uint64_t sub_bucket = index % sub_buckets_;
+  const uint64_t lower = (sub_buckets_ + sub_bucket) << (exponent - 3);
+  return lower + ((uint64_t(1) << (exponent - 3)) - 1);
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency){
+  const uint64_t value = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+  buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while(value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)){}
+}
+
+uint64_t LatencyHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double percentile) const {
+  // Counted from the buckets rather than count_, which may be ahead of them
+  uint64_t total = 0;
+  for(const auto& bucket : buckets_) total += bucket.load(std::memory_order_relaxed);
+  if(total == 0) return std::chrono::nanoseconds(0);
+
+  const double clamped = std::min(100.0, std::max(0.0, percentile));
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * total)));
+  uint64_t seen = 0;
+  for(size_t i = 0; i < n_buckets_; ++i){
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if(seen >= rank){
+      const uint64_t max = max_.load(std::memory_order_relaxed);
+      return std::chrono::nanoseconds(std::min(bucketUpperEdge(i), max));
+    }
+  }
+  return std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+  Summary summary;
+  summary.count = count();
+  summary.p50 = percentile(50);
+  summary.p99 = percentile(99);
+  summary.max = std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+  if(summary.count > 0){
+    summary.mean = std::chrono::nanoseconds(sum_.load(std::memory_order_relaxed) / summary.count);
+  }
+  return summary;
+}
+
+std::string LatencyHistogram::toString() const {
+  const Summary s = summary();
+  const auto ms = [](std::chrono::nanoseconds d){ return d.count() / 1e6; };
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2)
+    << "n " << s.count << ", p50 " << ms(s.p50) << " ms, p99 " << ms(s.p99)
+    << " ms, max " << ms(s.max) << " ms, mean " << ms(s.mean) << " ms";
+  return out.str();
+}
+
+void LatencyHistogram::reset(){
+  for(auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+}
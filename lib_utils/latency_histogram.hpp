@@ -0,0 +1,93 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+* @class LatencyHistogram
+* @brief Histogram of durations with logarithmic buckets
+* @details Each power of two is split into 8 buckets, so percentiles are
+accurate to within about 12% from a nanosecond up to centuries. Recording is
+wait free and may be done from several threads; queries may run concurrently
+with recording and see a consistent enough view for monitoring.
+*/
+class LatencyHistogram{
+public:
+
+  /**
+  * @struct Summary
+  * @brief Percentiles of the recorded durations
+  */
+  struct Summary{
+    /** \brief Number of durations recorded */
+    uint64_t count = 0;
+    /** \brief Median */
+    std::chrono::nanoseconds p50{0};
+    /** \brief 99th percentile */
+    std::chrono::nanoseconds p99{0};
+    /** \brief Longest duration recorded */
+    std::chrono::nanoseconds max{0};
+    /** \brief Mean */
+    std::chrono::nanoseconds mean{0};
+  };
+
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  /**
+  * @brief add a duration; negative durations are counted as zero
+  * @param [in] latency duration to add
+  * @return void
+  */
+  void record(std::chrono::nanoseconds latency);
+
+  /**
+  * @brief get the number of durations recorded
+  * @return uint64_t number of durations
+  */
+  uint64_t count() const;
+
+  /**
+  * @brief get a percentile of the recorded durations
+  * @param [in] percentile percentile between 0 and 100
+  * @return std::chrono::nanoseconds upper edge of the bucket holding the percentile, at most the maximum
+  */
+  std::chrono::nanoseconds percentile(double percentile) const;
+
+  /**
+  * @brief get the count, p50, p99, max and mean in one go
+  * @return Summary summary of the recorded durations
+  */
+  Summary summary() const;
+
+  /**
+  * @brief format the summary in milliseconds, eg for logging
+  * @return std::string summary as text
+  */
+  std::string toString() const;
+
+  /**
+  * @brief forget all recorded durations
+  * @return void
+  */
+  void reset();
+
+private:
+
+  enum{ sub_buckets_ = 8 };
+  enum{ n_buckets_ = 62 * sub_buckets_ };
+
+  static size_t bucketIndex(uint64_t value);
+  static uint64_t bucketUpperEdge(size_t index);
+
+  std::array<std::atomic<uint64_t>, n_buckets_> buckets_;
+  std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+};
+
+#endif // LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,99 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+* @class SPSCQueue
+* @brief Bounded lock free queue for exactly one producer thread and one consumer thread
+* @details The capacity is rounded up to the next power of two. Neither side
+ever blocks; tryPush fails when the queue is full and tryPop fails when it is
+empty, leaving the caller to decide whether to drop or wait.
+*/
+template <typename T>
+class SPSCQueue{
+public:
+
+  /**
+  * @brief Constructor
+  * @param [in] capacity minimum number of elements the queue can hold
+  * @return none
+  */
+  explicit SPSCQueue(size_t capacity) : buffer_(roundUp(capacity)), mask_(buffer_.size() - 1) {}
+
+  SPSCQueue(const SPSCQueue&) = delete;
+  SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+  /**
+  * @brief add an element to the back of the queue; producer thread only
+  * @param [in] value element to be moved into the queue
+  * @return bool false if the queue is full, in which case value is left untouched
+  */
+  bool tryPush(T&& value){
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail - head_.load(std::memory_order_acquire) == buffer_.size()){
+      return false;
+    }
+    buffer_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+  * @brief remove the element at the front of the queue; consumer thread only
+  * @param [out] value element moved out of the queue
+  * @return bool false if the queue is empty
+  */
+  bool tryPop(T& value){
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if(head == tail_.load(std::memory_order_acquire)){
+      return false;
+    }
+    value = std::move(buffer_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+  * @brief number of elements currently in the queue; approximate when called concurrently
+  * @return size_t number of elements
+  */
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  /**
+  * @brief whether the queue is empty; approximate when called concurrently
+  * @return bool whether the queue is empty
+  */
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /**
+  * @brief maximum number of elements the queue can hold
+  * @return size_t capacity
+  */
+  size_t capacity() const {
+    return buffer_.size();
+  }
+
+private:
+
+  static size_t roundUp(size_t n){
+    size_t p = 1;
+    while(p < n) p <<= 1;
+    return p;
+  }
+
+  std::vector<T> buffer_;
+  const size_t mask_;
+  // Kept on separate cache lines so that producer and consumer do not false share
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif // SPSC_QUEUE_HPP
@@ -1,3 +1,7 @@
+#include <chrono>
+#include <future>
+#include <memory>
+
 #include "base_socket.hpp"
 
 BaseSocket::BaseSocket(
@@ -17,3 +21,32 @@ BaseSocket::BaseSocket(
 BaseSocket::~BaseSocket(){
   socket_.close();
 }
+
+void BaseSocket::setCapture(std::shared_ptr<CaptureWriter> capture, CaptureStream stream){
+  capture_stream_ = stream;
+  capture_ = std::move(capture);
+}
+
+void BaseSocket::capture(const void* data, size_t size){
+  if(capture_) capture_->write(capture_stream_, static_cast<const unsigned char*>(data), size);
+}
+
+void BaseSocket::startReplay(){
+  // The socket may only be touched by the io_service threads. The promise
+  // is shared, as the wait gives up if the io_service is stopped.
+  auto cancelled = std::make_shared<std::promise<void>>();
+  std::future<void> done = cancelled->get_future();
+  io_service_.post([this, cancelled]{
+    replaying_ = true;
+    asio::error_code error;
+    socket_.cancel(error);
+    cancelled->set_value();
+  });
+  while(done.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready){
+    if(io_service_.stopped()) return;
+  }
+}
+
+void BaseSocket::injectDatagram(const unsigned char* data, size_t size){
+  if(replaying_) processInjectedDatagram(data, size);
+}
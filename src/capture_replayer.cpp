@@ -0,0 +1,47 @@
+#include <chrono>
+#include <thread>
+
+#include "capture_replayer.hpp"
+#include "utils.hpp"
+
+CaptureReplayer::CaptureReplayer(const std::string& file_name)
+  :
+  file_name_(file_name)
+{
+}
+
+void CaptureReplayer::addTarget(CaptureStream stream, BaseSocket& socket){
+  targets_[stream] = &socket;
+}
+
+size_t CaptureReplayer::run(double speed){
+  CaptureReader reader(file_name_);
+  if(!reader.isOpen()) return 0;
+
+  for(auto& target : targets_){
+    target.second->startReplay();
+  }
+  utils_log::LogInfo() << "Replaying [" << file_name_ << "].";
+
+  size_t n_injected = 0;
+  CaptureRecord record;
+  const auto start = std::chrono::steady_clock::now();
+  while(on_ && reader.next(record)){
+    const auto target = targets_.find(record.stream);
+    if(target == targets_.end()) continue;
+    if(speed > 0){
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+        static_cast<int64_t>(record.timestamp_ns / speed)));
+    }
+    target->second->injectDatagram(record.payload.data(), record.payload.size());
+    n_injected++;
+  }
+
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  utils_log::LogInfo() << "Replayed " << n_injected << " datagrams in " << elapsed << " s.";
+  return n_injected;
+}
+
+void CaptureReplayer::stop(){
+  on_ = false;
+}
@@ -1,9 +1,12 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 #include "command_socket.hpp"
 #include "utils.hpp"
 
 #define UDP asio::ip::udp
-#define ASYNC_RECEIVE socket_.async_receive_from( asio::buffer(data_, max_length_), endpoint_, [&](const std::error_code& error, size_t bytes_recvd) {return handleResponseFromDrone(error, bytes_recvd);}); // [&](auto... args){return handleResponseFromDrone(args...);});
-#define ASYNC_SEND socket_.async_send_to( asio::buffer(cmd, cmd.size()), endpoint_, [&](const std::error_code& error, size_t bytes_recvd) {return handleSendCommand(error, bytes_recvd, cmd);}); // [&](auto... args){return handleSendCommand(args..., cmd);});
+#define ASYNC_RECEIVE pending_io_++; socket_.async_receive_from( asio::buffer(data_, max_length_), endpoint_, [&](const std::error_code& error, size_t bytes_recvd) {handleResponseFromDrone(error, bytes_recvd); pending_io_--;}); // [&](auto... args){return handleResponseFromDrone(args...);});
 
 // NOTE: Possible methods to call threads
 // io_thread(boost::bind(&boost::asio::io_service::run, boost::ref(io_service_)));
@@ -18,11 +21,17 @@ CommandSocket::CommandSocket(
   const std::string& drone_port,
   const std::string& local_port,
   int n_retries_allowed,
-  int timeout
+  std::chrono::milliseconds timeout,
+  int rc_rate
 ):
   BaseSocket(io_service, drone_ip, drone_port, local_port),
   timeout_(timeout),
-  n_retries_allowed_(n_retries_allowed)
+  n_retries_allowed_(n_retries_allowed),
+  timer_(io_service),
+  dnal_timer_(io_service),
+  command_counters_(new CommandCounters[command_count]),
+  rc_period_(std::chrono::microseconds(1000000 / std::min(100, std::max(1, rc_rate)))),
+  rc_timer_(io_service)
 {
   // NOTE: Used #define UDP to handle namespace
   UDP::resolver resolver(io_service_);
@@ -32,27 +41,18 @@ CommandSocket::CommandSocket(
   io_thread = std::thread([&]{io_service_.run();
     utils_log::LogDebug() << "----------- Command socket io_service thread exits -----------";
   });
-  cmd_thread = std::thread(&CommandSocket::sendQueueCommands, this);
-  dnal_thread = std::thread(&CommandSocket::doNotAutoLandWorker, this);
   io_thread.detach();
-  cmd_thread.detach();
-  dnal_thread.detach();
-  command_sent_time_ = std::chrono::system_clock::now();
+  command_sent_time_ = std::chrono::steady_clock::now();
   ASYNC_RECEIVE;
+  transmit(cmd::Rc{0, 0, 0, 0});
 }
 
 void CommandSocket::handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd)
 {
+ if(replaying_ || closing_) return;
  if(!error && bytes_recvd>0){
-   waiting_for_response_ = false;
-   response_ = "";
-   const std::string response_temp = std::string(data_);
-   //remove additional random characters sent over UDP
-   // TODO: Make this better
-   for(int i=0; i<bytes_recvd && isprint(response_temp[i]); ++i){
-     response_+=response_temp[i];
-   }
-   utils_log::LogInfo() << "Received response [" << response_ << "] after sending command ["<< last_command_ << "] from address [" << drone_ip_ << ":" << drone_port_ << "].";
+   capture(data_, bytes_recvd);
+   processResponse(bytes_recvd);
  }
  else{
    utils_log::LogWarn() << "Error/Nothing received.";
@@ -60,128 +60,313 @@ void CommandSocket::handleResponseFromDrone(const std::error_code& error, size_t
  ASYNC_RECEIVE;
 }
 
-void CommandSocket::sendCommand(const std::string& cmd){
-  n_retries_ = 0;
-  ASYNC_SEND;
-  usleep(1000); //TODO: reduce this to less than amount of time joystick waits?
+void CommandSocket::processInjectedDatagram(const unsigned char* data, size_t size)
+{
+  size = std::min<size_t>(size, max_length_);
+  memcpy(data_, data, size);
+  processResponse(size);
+}
+
+void CommandSocket::processResponse(size_t bytes_recvd)
+{
+  const auto received = std::chrono::steady_clock::now();
+  bool out_of_band = false;
+  TelloCommand answered;
+  {
+    // The next command of the queue goes out before anything else is done
+    std::lock_guard<std::mutex> lk(queue_mutex_);
+    answered = last_command_;
+    if(out_of_band_awaiting_ > 0 && received - out_of_band_sent_ > timeout_){
+      out_of_band_awaiting_ = 0;
+    }
+    if(out_of_band_awaiting_ > 0){
+      // The response to a command sent outside the queue
+      out_of_band_awaiting_--;
+      out_of_band = true;
+    }
+    else if(queue_state_ == QueueState::AwaitingResponse){
+      answered = in_flight_;
+      cancelTimer();
+      queue_state_ = QueueState::Idle;
+      sendQueueCommands();
+    }
+  }
+  response_ = "";
+  //remove additional random characters sent over UDP
+  // TODO: Make this better
+  for(size_t i=0; i<bytes_recvd && isprint(data_[i]); ++i){
+    response_+=data_[i];
+  }
+  AwaitedResponse awaited;
+  bool matched = false;
+  {
+    std::lock_guard<std::mutex> lk(stats_mutex_);
+    matched = takeAwaited(out_of_band, received, awaited);
+    if(!matched) unmatched_responses_++;
+  }
+  if(matched){
+    awaited.counters->rtt.record(received - awaited.since);
+    awaited.counters->responses++;
+    if(response_.compare(0, 5, "error") == 0) awaited.counters->errors++;
+  }
+  utils_log::LogInfo() << "Received response [" << response_ << "] after sending command ["<< answered.data() << "] from address [" << drone_ip_ << ":" << drone_port_ << "].";
 }
 
-void CommandSocket::waitForResponse(){
-  std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
-  while(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - start).count() < timeout_ && on_){
-    if(!waiting_for_response_){
+bool CommandSocket::takeAwaited(bool out_of_band, std::chrono::steady_clock::time_point received, AwaitedResponse& answered){
+  // Responses that are overdue were lost
+  while(awaited_count_ > 0 && received - awaited_[awaited_first_].since > timeout_){
+    awaited_first_ = (awaited_first_ + 1) % n_awaited_;
+    awaited_count_--;
+  }
+  if(awaited_count_ == 0) return false;
+  // The oldest command of the same kind, else the oldest of all
+  size_t found = 0;
+  for(size_t i = 0; i < awaited_count_; ++i){
+    if(awaited_[(awaited_first_ + i) % n_awaited_].out_of_band == out_of_band){
+      found = i;
       break;
     }
-    usleep(100000);// TODO: replace with condition variable
   }
-  if(!on_){
-    waiting_for_response_ = false;
+  answered = awaited_[(awaited_first_ + found) % n_awaited_];
+  for(size_t i = found; i + 1 < awaited_count_; ++i){
+    awaited_[(awaited_first_ + i) % n_awaited_] = awaited_[(awaited_first_ + i + 1) % n_awaited_];
+  }
+  awaited_count_--;
+  return true;
+}
+
+void CommandSocket::sendCommand(const std::string& cmd){
+  TelloCommand parsed;
+  if(!TelloCommand::parse(cmd, parsed)){
+    utils_log::LogWarn() << "Ignoring command [" << cmd << "]; it is empty or longer than " << TelloCommand::max_size << " characters.";
     return;
   }
-  if(waiting_for_response_) utils_log::LogInfo() << "Timeout - Attempt #" << n_retries_ << " for command [" << last_command_ << "].";
-  if(n_retries_ == n_retries_allowed_){
-    if(n_retries_allowed_ > 0){
-      utils_log::LogWarn() << "Exhausted retries." ;
+  sendCommand(parsed);
+}
+
+void CommandSocket::sendCommand(const TelloCommand& cmd){
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  sendOutOfBand(cmd);
+}
+
+void CommandSocket::sendOutOfBand(const TelloCommand& cmd){
+  if(cmd.spec().expects_response){
+    out_of_band_awaiting_++;
+    out_of_band_sent_ = std::chrono::steady_clock::now();
+  }
+  transmit(cmd, true);
+}
+
+bool CommandSocket::sendCommandIfIdle(const TelloCommand& cmd){
+  // Neither awaiting a response nor in a delay, after which the next command
+  // of the queue would take the response to this one
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  if(queue_state_ != QueueState::Idle) return false;
+  sendOutOfBand(cmd);
+  return true;
+}
+
+void CommandSocket::transmit(const TelloCommand& cmd, bool out_of_band){
+  {
+    CommandCounters& sent = counters(cmd.id());
+    sent.sent++;
+    if(cmd.spec().expects_response){
+      std::lock_guard<std::mutex> lk(stats_mutex_);
+      if(awaited_count_ == n_awaited_){
+        awaited_first_ = (awaited_first_ + 1) % n_awaited_;
+        awaited_count_--;
+      }
+      awaited_[(awaited_first_ + awaited_count_++) % n_awaited_] =
+        AwaitedResponse{&sent, std::chrono::steady_clock::now(), out_of_band};
     }
-    waiting_for_response_ = false; // Timeout
   }
+  // A replay feeds the handlers the responses of the capture; the commands
+  // they trigger are counted but not sent to whatever is on the network
+  if(replaying_) return;
+  // The buffer has to outlive the asynchronous send
+  for(int i = 0; i < n_send_buffers_; ++i){
+    SendBuffer& buffer = send_buffers_[next_send_buffer_++ % n_send_buffers_];
+    bool busy = false;
+    if(!buffer.busy.compare_exchange_strong(busy, true)) continue;
+    buffer.cmd = cmd;
+    pending_io_++;
+    socket_.async_send_to(asio::buffer(buffer.cmd.data(), buffer.cmd.size()), endpoint_,
+      [this, &buffer](const std::error_code& error, size_t bytes_sent){
+        commandSent(error, bytes_sent, buffer.cmd);
+        buffer.busy = false;
+        pending_io_--;
+      });
+    return;
+  }
+  send_buffer_misses_++;
+  auto buffer = std::make_shared<TelloCommand>(cmd);
+  pending_io_++;
+  socket_.async_send_to(asio::buffer(buffer->data(), buffer->size()), endpoint_,
+    [this, buffer](const std::error_code& error, size_t bytes_sent){
+      commandSent(error, bytes_sent, *buffer);
+      pending_io_--;
+    });
 }
 
 void CommandSocket::handleSendCommand(const std::error_code& error, size_t bytes_sent, std::string cmd)
+{
+  TelloCommand sent;
+  TelloCommand::parse(cmd, sent);
+  commandSent(error, bytes_sent, sent);
+}
+
+void CommandSocket::commandSent(const std::error_code& error, size_t bytes_sent, const TelloCommand& cmd)
 {
  if(!error && bytes_sent>0){
-   utils_log::LogInfo() << "Successfully sent command [" << cmd << "] to address [" << drone_ip_ << ":" << drone_port_ << "].";
+   // rc goes out at the rate of the rc channel; its counters are in the stats
+   if(cmd.id() != CommandId::Rc){
+     utils_log::LogInfo() << "Successfully sent command [" << cmd.data() << "] to address [" << drone_ip_ << ":" << drone_port_ << "].";
+   }
+   commands_sent_++;
+   std::lock_guard<std::mutex> lk(queue_mutex_);
    last_command_ = cmd;
-   command_sent_time_ = std::chrono::system_clock::now();
+   command_sent_time_ = std::chrono::steady_clock::now();
  }
  else{
-   utils_log::LogDebug() << "Failed to send command [" << cmd <<"].";
+   utils_log::LogDebug() << "Failed to send command [" << cmd.data() <<"].";
  }
 }
 
-void CommandSocket::retry(const std::string& cmd){
-  last_command_ = cmd;
-  waitForResponse();
-  if(!waiting_for_response_) return;
-   while(n_retries_ < n_retries_allowed_ && waiting_for_response_ && on_){
-    utils_log::LogInfo() << "Retrying..." ;
-    n_retries_++;
-    ASYNC_SEND;
-    waitForResponse();
+void CommandSocket::sendQueueCommands(){
+  while(on_ && execute_queue_ && !command_queue_.empty()){
+    const CommandSpec& next = command_queue_.front().spec();
+    if(queue_state_ != QueueState::Idle){
+      if(!next.preempts) return;
+      // Sent without waiting for the response to the previous command or the
+      // end of a delay
+      cancelTimer();
+      queue_state_ = QueueState::Idle;
+    }
+    const TelloCommand cmd = command_queue_.front();
+    command_queue_.pop_front();
+    if(cmd.spec().local){
+      // The only local command is delay
+      const char* begin = cmd.data() + strlen(cmd.spec().word);
+      char* end = nullptr;
+      const double seconds = strtod(begin, &end);
+      if(end == begin){
+        utils_log::LogWarn() << "Ignoring command [" << cmd.data() << "]; the delay has to be given in seconds.";
+        continue;
+      }
+      queue_state_ = QueueState::Delaying;
+      armTimer(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+      return;
+    }
+    transmit(cmd);
+    // NOTE: Do not comment. Set n_retries_allowed_ to 0 if required.
+    // If the drone does not respond to the command, eg rc, do not retry/wait for a response
+    if(!cmd.spec().expects_response) continue;
+    in_flight_ = cmd;
+    n_retries_ = 0;
+    queue_state_ = QueueState::AwaitingResponse;
+    armTimer(timeout_);
+    return;
+  }
+}
+
+void CommandSocket::armTimer(std::chrono::steady_clock::duration after){
+  const uint64_t generation = ++timer_generation_;
+  timer_.expires_from_now(after);
+  pending_timers_++;
+  timer_.async_wait([this, generation](const std::error_code& error){
+    handleTimer(error, generation);
+    pending_timers_--;
+  });
+}
+
+void CommandSocket::cancelTimer(){
+  // A handler already queued finds the generation changed
+  ++timer_generation_;
+  asio::error_code error;
+  timer_.cancel(error);
+}
+
+void CommandSocket::abandonInFlight(){
+  // A lost response to eg "stop" must not get the command it overrode resent
+  cancelTimer();
+  queue_state_ = QueueState::Idle;
+  in_flight_ = TelloCommand();
+}
+
+void CommandSocket::handleTimer(const std::error_code& error, uint64_t generation){
+  if(error) return; // Cancelled, possibly by the destructor
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  if(!on_ || generation != timer_generation_) return;
+  if(queue_state_ == QueueState::AwaitingResponse){
+    utils_log::LogInfo() << "Timeout - Attempt #" << n_retries_ << " for command [" << in_flight_.data() << "].";
+    // Nothing is resent once queue execution was stopped
+    const bool retry = execute_queue_ && in_flight_.spec().retry && n_retries_ < n_retries_allowed_;
+    CommandCounters& timed_out = counters(in_flight_.id());
+    timed_out.timeouts++;
+    if(retry) timed_out.retries++;
+    if(retry){
+      utils_log::LogInfo() << "Retrying..." ;
+      n_retries_++;
+      transmit(in_flight_);
+      armTimer(timeout_);
+      return;
+    }
+    if(!in_flight_.spec().retry && n_retries_allowed_ > 0){
+      // Resending a manoeuvre runs it twice if only the response was lost
+      utils_log::LogWarn() << "Not retrying command [" << in_flight_.data() << "].";
+    }
+    else if(n_retries_allowed_ > 0){
+      utils_log::LogWarn() << "Exhausted retries." ;
+    }
   }
+  queue_state_ = QueueState::Idle;
+  sendQueueCommands();
 }
 
 void CommandSocket::addCommandToQueue(const std::string& cmd){
-  queue_mutex_.lock();
-  utils_log::LogInfo() << "Added command ["<< cmd<<"] to queue.";
+  TelloCommand parsed;
+  if(!TelloCommand::parse(cmd, parsed)){
+    utils_log::LogWarn() << "Ignoring command [" << cmd << "]; it is empty or longer than " << TelloCommand::max_size << " characters.";
+    return;
+  }
+  addCommandToQueue(parsed);
+}
+
+void CommandSocket::addCommandToQueue(const TelloCommand& cmd){
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  utils_log::LogInfo() << "Added command ["<< cmd.data()<<"] to queue.";
   command_queue_.push_back(cmd);
-  queue_mutex_.unlock();
-  cv_execute_queue_.notify_all();
+  max_queue_depth_ = std::max(max_queue_depth_, command_queue_.size());
+  sendQueueCommands();
 }
 
 void CommandSocket::executeQueue(){
   utils_log::LogInfo() << "Executing queue commands.";
-  {
-    std::lock_guard<std::mutex> lk(m);
-    execute_queue_ = true;
-  }
-  cv_execute_queue_.notify_all();
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  execute_queue_ = true;
+  sendQueueCommands();
 }
 
-void CommandSocket::sendQueueCommands(){
-  std::string cmd;
-  while(on_){
-    usleep(1000); // allow others to grab lock
-    {
-      std::unique_lock<std::mutex> lk(m);
-      cv_execute_queue_.wait(lk, [this]{return (execute_queue_ && !command_queue_.empty()) || !on_;});
-    }
-    if(!on_) break;
-    while(!command_queue_.empty() && execute_queue_){
-      queue_mutex_.lock();
-      cmd = command_queue_.front();
-      command_queue_.pop_front();
-      queue_mutex_.unlock();
-      if(cmd.substr(0,5) == "delay"){
-        usleep(1000000 * stoi(cmd.substr(5, cmd.size())));
-        continue;
-      }
-      else if(cmd.substr(0,4) =="stop" || cmd.substr(0,9) =="emergency"){
-        waiting_for_response_ = false; // to prevent retries of prev sent command if none received in spit of comman dbeing sent.
-      }
-      // Run reponse thread only after sending command rather than always
-      // TODO: Use condition variable for the wait for response
-      if(waiting_for_response_){
-        // usleep(10000); // Next send command grabs mutex before handleSendCommand.
-        // TODO: The above should no longer be required
-        utils_log::LogInfo() << "Waiting to send command [" << cmd << "] as no response has been received for the previous command. Thread calling send command paused." ;
-      }
-      while(waiting_for_response_){
-        if(!on_) break;
-        usleep(500000);
-      }
-      waiting_for_response_ = true;
-      sendCommand(cmd);
-      // NOTE: Do not comment. Set n_retries_allowed_ to 0 if required.
-      // If the commmand is rc, do not retry/wait for a response
-      if(cmd.substr(0,2)!="rc"){
-        std::thread run_thread([&]{retry(cmd);});
-        run_thread.detach();
-      }
-    }
+void CommandSocket::addCommandToFrontOfQueue(const std::string& cmd){
+  TelloCommand parsed;
+  if(!TelloCommand::parse(cmd, parsed)){
+    utils_log::LogWarn() << "Ignoring command [" << cmd << "]; it is empty or longer than " << TelloCommand::max_size << " characters.";
+    return;
   }
-  utils_log::LogDebug() << "----------- Send queue commands thread exits -----------";
+  addCommandToFrontOfQueue(parsed);
 }
 
-void CommandSocket::addCommandToFrontOfQueue(const std::string& cmd){
-  queue_mutex_.lock();
+void CommandSocket::addCommandToFrontOfQueue(const TelloCommand& cmd){
+  std::lock_guard<std::mutex> lk(queue_mutex_);
   command_queue_.push_front(cmd);
-  queue_mutex_.unlock();
+  max_queue_depth_ = std::max(max_queue_depth_, command_queue_.size());
+  // Eg "stop" is sent at once, even while a command awaits its response
+  sendQueueCommands();
 }
 
 void CommandSocket::stopQueueExecution(){
+  std::lock_guard<std::mutex> lk(queue_mutex_);
   utils_log::LogInfo() << "Stopping queue execution. " << command_queue_.size() << " commands still in queue.";
-  std::lock_guard<std::mutex> lk(m);
   execute_queue_ = false;
 }
 
@@ -194,63 +379,70 @@ void CommandSocket::clearQueue(){
 
 void CommandSocket::removeNextFromQueue(){
   queue_mutex_.lock();
-  std::string cmd = command_queue_.front();
+  TelloCommand cmd = command_queue_.front();
   command_queue_.pop_front();
   queue_mutex_.unlock();
-  utils_log::LogInfo() << "Removed command [" << cmd << "] from queue.";
+  utils_log::LogInfo() << "Removed command [" << cmd.data() << "] from queue.";
 }
 
 void CommandSocket::doNotAutoLand(){
   utils_log::LogDebug() << "Automatic landing disabled.";
-  {
-    std::lock_guard<std::mutex> lk(dnal_mutex);
-    dnal_ = true;
-  }
-  cv_dnal_.notify_all();
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  if(dnal_ || !on_) return;
+  dnal_ = true;
+  armDnalTimer(std::chrono::seconds(dnal_timeout));
 }
 
 void CommandSocket::allowAutoLand(){
   utils_log::LogDebug() << "Automatic landing enabled.";
-  {
-    std::lock_guard<std::mutex> lk(dnal_mutex);
-    dnal_ = false;
-  }
-  cv_dnal_.notify_all();
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  dnal_ = false;
+  ++dnal_generation_;
+  asio::error_code error;
+  dnal_timer_.cancel(error);
 }
 
-void CommandSocket::doNotAutoLandWorker(){
-  std::chrono::system_clock::time_point start;
-  std::string cmd = "rc 0 0 0 0";
-  sendCommand(cmd);
-  int dnal_timeout_in_us = dnal_timeout*1000000;
-  while(on_){
-    {
-      std::unique_lock<std::mutex> lk(dnal_mutex);
-      cv_dnal_.wait(lk, [this]{return (((!execute_queue_) || (execute_queue_ && command_queue_.empty())) && dnal_) || !on_;});
-    }
-    if(!on_) break;
-    if(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - command_sent_time_).count() > dnal_timeout){
-      sendCommand(cmd);
-      last_command_ = cmd;
-      waiting_for_response_ = false;
-    }
-    else{
-      usleep(dnal_timeout_in_us); //10 seconds, command needs to be sent ever 15
-    }
+void CommandSocket::armDnalTimer(std::chrono::steady_clock::duration after){
+  const uint64_t generation = ++dnal_generation_;
+  dnal_timer_.expires_from_now(after);
+  pending_timers_++;
+  dnal_timer_.async_wait([this, generation](const std::error_code& error){
+    handleDnalTimer(error, generation);
+    pending_timers_--;
+  });
+}
+
+void CommandSocket::handleDnalTimer(const std::error_code& error, uint64_t generation){
+  if(error) return;
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  if(!on_ || !dnal_ || generation != dnal_generation_) return;
+  const std::chrono::steady_clock::duration limit = std::chrono::seconds(dnal_timeout);
+  const auto idle_for = std::chrono::steady_clock::now() - command_sent_time_;
+  // The queue keeps the drone busy while it is executed
+  if((!execute_queue_ || command_queue_.empty()) && idle_for >= limit){
+    transmit(cmd::Rc{0, 0, 0, 0});
+    command_sent_time_ = std::chrono::steady_clock::now();
+    armDnalTimer(limit);
+  }
+  else{
+    armDnalTimer(idle_for < limit ? limit - idle_for : limit);
   }
-  utils_log::LogDebug() << "----------- DNAL worker thread exits -----------";
 }
 
 void CommandSocket::stop(){
-  std::lock_guard<std::mutex> lk(m);
+  std::lock_guard<std::mutex> lk(queue_mutex_);
   execute_queue_ = false;
-  sendCommand("stop");
+  abandonInFlight();
+  zeroRc();
+  sendOutOfBand(cmd::Stop{});
 }
 
 void CommandSocket::emergency(){
-  std::lock_guard<std::mutex> lk(m);
+  std::lock_guard<std::mutex> lk(queue_mutex_);
   execute_queue_ = false;
-  sendCommand("emergency");
+  abandonInFlight();
+  zeroRc();
+  sendOutOfBand(cmd::Emergency{});
 }
 
 bool CommandSocket::isExecutingQueue(){
@@ -259,24 +451,150 @@ bool CommandSocket::isExecutingQueue(){
 
 void CommandSocket::land(){
   allowAutoLand();
-  sendCommand("land");
+  zeroRc();
+  sendCommand(cmd::Land{});
 }
 
-// TODO: Refactor exit of dnal worker thread
-CommandSocket::~CommandSocket(){
+void CommandSocket::setRc(int a, int b, int c, int d){
+  const auto pack = [](int value, int shift){
+    return static_cast<uint64_t>(static_cast<uint8_t>(std::max(-100, std::min(100, value)))) << shift;
+  };
+  rc_updates_++;
+  if(rc_setpoint_.exchange(pack(a, 0) | pack(b, 8) | pack(c, 16) | pack(d, 24) | rc_dirty_) & rc_dirty_){
+    rc_coalesced_++;
+  }
+  startRc();
+}
+
+void CommandSocket::zeroRc(){
+  // The channel sends zero a few times and goes quiet, rather than keep
+  // sending a stick setpoint that overrides the command that follows
+  rc_setpoint_ = rc_dirty_;
+  startRc();
+}
+
+void CommandSocket::startRc(){
+  if(rc_active_.exchange(true)) return;
+  // The first setpoint after a quiet spell goes out at once
+  pending_timers_++;
+  io_service_.post([this]{
+    {
+      std::lock_guard<std::mutex> lk(queue_mutex_);
+      if(on_) sendRc();
+    }
+    pending_timers_--;
+  });
+}
+
+void CommandSocket::sendRc(){
+  const uint64_t setpoint = rc_setpoint_.fetch_and(~rc_dirty_);
+  if(setpoint & rc_dirty_) rc_zero_left_ = rc_zero_repeats_;
+  const uint32_t values = static_cast<uint32_t>(setpoint);
+  if(values != 0 || rc_zero_left_-- > 0){
+    transmit(cmd::Rc{static_cast<int8_t>(values), static_cast<int8_t>(values >> 8),
+      static_cast<int8_t>(values >> 16), static_cast<int8_t>(values >> 24)});
+    rc_sent_++;
+    armRcTimer();
+    return;
+  }
+  rc_active_ = false;
+  // A setpoint set since it was taken above is still sent; its setter found
+  // the channel active
+  if((rc_setpoint_.load() & rc_dirty_) && !rc_active_.exchange(true)) armRcTimer();
+}
+
+void CommandSocket::armRcTimer(){
+  rc_timer_.expires_from_now(rc_period_);
+  pending_timers_++;
+  rc_timer_.async_wait([this](const std::error_code& error){
+    handleRcTimer(error);
+    pending_timers_--;
+  });
+}
+
+void CommandSocket::handleRcTimer(const std::error_code& error){
+  if(error) return;
+  std::lock_guard<std::mutex> lk(queue_mutex_);
+  if(on_) sendRc();
+}
+
+CommandQueueStats CommandSocket::getQueueStats() const{
+  CommandQueueStats stats;
   {
-    std::lock_guard<std::mutex> lk(dnal_mutex);
-    dnal_ = true; // allow dnal thread to exit
-    std::lock_guard<std::mutex> lk_2(m);
-    execute_queue_ = false; // also allow dnal thread to exit
-    on_ = false;
+    std::lock_guard<std::mutex> lk(queue_mutex_);
+    stats.queue_depth = command_queue_.size();
+    stats.max_queue_depth = max_queue_depth_;
+  }
+  stats.commands_sent = commands_sent_;
+  stats.pending_timers = pending_timers_;
+  stats.rc_updates = rc_updates_;
+  stats.rc_sent = rc_sent_;
+  stats.rc_coalesced = rc_coalesced_;
+  stats.send_buffer_misses = send_buffer_misses_;
+  std::lock_guard<std::mutex> lk(stats_mutex_);
+  stats.unmatched_responses = unmatched_responses_;
+  return stats;
+}
+
+CommandSocket::CommandCounters& CommandSocket::counters(CommandId id){
+  return command_counters_[static_cast<size_t>(id)];
+}
+
+std::vector<CommandTypeStats> CommandSocket::getCommandStats() const{
+  std::vector<CommandTypeStats> stats;
+  for(const CommandSpec& spec : command_table){
+    const CommandCounters& c = command_counters_[static_cast<size_t>(spec.id)];
+    if(c.sent == 0 && c.responses == 0) continue;
+    CommandTypeStats type;
+    type.command = spec.id == CommandId::Raw ? "other" : spec.word;
+    type.sent = c.sent;
+    type.responses = c.responses;
+    type.errors = c.errors;
+    type.retries = c.retries;
+    type.timeouts = c.timeouts;
+    type.rtt = c.rtt.summary();
+    stats.push_back(type);
   }
-  cv_dnal_.notify_all();
-  usleep(1000); // allow dnal thread to exit before setting execute_queue_ to true.
+  return stats;
+}
+
+CommandSocket::~CommandSocket(){
   {
-    std::lock_guard<std::mutex> lk(m);
-    execute_queue_ = true;
+    std::lock_guard<std::mutex> lk(queue_mutex_);
+    execute_queue_ = false;
+    dnal_ = false;
+    on_ = false;
+    cancelTimer();
+    ++dnal_generation_;
+    asio::error_code error;
+    dnal_timer_.cancel(error);
+    rc_timer_.cancel(error);
   }
-  cv_execute_queue_.notify_all();
+  // The receive is cancelled by the io_service thread, which alone uses the
+  // socket
+  closing_ = true;
+  pending_io_++;
+  io_service_.post([this]{
+    asio::error_code error;
+    socket_.cancel(error);
+    pending_io_--;
+  });
+  // The cancelled handlers still run on the io_service thread, and use the
+  // socket; once it is stopped they never run
+  while((pending_timers_ > 0 || pending_io_ > 0) && !io_service_.stopped()) usleep(1000);
 
+  const CommandQueueStats stats = getQueueStats();
+  utils_log::LogInfo() << "Command socket: sent " << stats.commands_sent << " commands, "
+    << stats.queue_depth << " left in the queue (max depth " << stats.max_queue_depth << "), "
+    << stats.unmatched_responses << " unmatched responses. rc channel: "
+    << stats.rc_updates << " setpoints, " << stats.rc_sent << " sent, "
+    << stats.rc_coalesced << " replaced before being sent. "
+    << stats.send_buffer_misses << " sends allocated a buffer.";
+  for(const CommandSpec& spec : command_table){
+    const CommandCounters& c = command_counters_[static_cast<size_t>(spec.id)];
+    if(c.sent == 0 && c.responses == 0) continue;
+    utils_log::LogInfo() << "Command [" << (spec.id == CommandId::Raw ? "other" : spec.word) << "]: sent " << c.sent << ", "
+      << c.responses << " responses (" << c.errors << " errors), " << c.retries << " retries, "
+      << c.timeouts << " timeouts. Round trip " << c.rtt.toString();
+  }
 }
@@ -7,6 +7,17 @@
 #include "utils.hpp"
 #include "tello.hpp"
 
+static ConverterBackend toConverterBackend(const std::string& name){
+  if(name == "swscale") return ConverterBackend::Swscale;
+  if(name == "scalar") return ConverterBackend::Scalar;
+  if(name == "sse4") return ConverterBackend::SSE4;
+  if(name == "avx2") return ConverterBackend::AVX2;
+  if(name != "auto"){
+    utils_log::LogWarn() << "Unknown converter [" << name << "]. Using the fastest available.";
+  }
+  return ConverterBackend::Auto;
+}
+
 std::map<std::string, std::unique_ptr<Tello>> handleConfig(
   const std::string& config_file,
   asio::io_service& io_service,
@@ -47,6 +58,18 @@ std::map<std::string, std::unique_ptr<Tello>> handleConfig(
 
         std::string identifier = std::to_string(group_n) + "." + type_id + "." + std::to_string(member_n);
 
+        // Optional; slice threading with one thread per core by default
+        const H264ThreadType decoder_thread_type =
+          config[type_id]["decoder_thread_type"].as<std::string>("slice") == "frame" ?
+          H264ThreadType::Frame : H264ThreadType::Slice;
+
+        // Optional; nothing is exported without a name
+        FrameExportOptions frame_export;
+        frame_export.shm_name = config[type_id]["shm_name"].as<std::string>("");
+        frame_export.spec = FrameSpec{config[type_id]["shm_width"].as<int>(0),
+          config[type_id]["shm_height"].as<int>(0),
+          config[type_id]["shm_gray"].as<bool>(false) ? OutputFormat::GRAY8 : OutputFormat::BGR24};
+
         auto a = std::make_unique<Tello>(io_service,
           cv_run,
           config[type_id]["drone_ip"].as<std::string>(),
@@ -56,16 +79,32 @@ std::map<std::string, std::unique_ptr<Tello>> handleConfig(
           config[type_id]["camera_config_file"].as<std::string>(),
           config[type_id]["vocabulary_file"].as<std::string>(),
           config[type_id]["retries"].as<int>(),
-          config[type_id]["timeout"].as<int>(),
+          config[type_id]["timeout"].as<double>(),
           config[type_id]["load_map_db_path"].as<std::string>(),
           config[type_id]["save_map_db_path"].as<std::string>(),
           config[type_id]["mask_img_path"].as<std::string>(),
           config[type_id]["load_map"].as<bool>(),
           config[type_id]["continue_mapping"].as<bool>(),
           config[type_id]["scale"].as<double>(), // NOTE: double to float implicit conversion
-          config[type_id]["sequence_file"].as<std::string>()
-          // TODO: Config object?
+          config[type_id]["sequence_file"].as<std::string>(),
+          config[type_id]["decoder_threads"].as<int>(1),
+          decoder_thread_type,
+          toConverterBackend(config[type_id]["converter"].as<std::string>("auto")),
+          config[type_id]["snapshot_burst"].as<int>(1),
+          config[type_id]["capture_file"].as<std::string>(""),
+          config[type_id]["request_keyframes"].as<bool>(false),
+          config[type_id]["preview_width"].as<int>(0),
+          config[type_id]["preview_height"].as<int>(0),
+          config[type_id]["decode_workers"].as<int>(0),
+          frame_export,
+          config[type_id]["show_video"].as<bool>(true),
+          config[type_id]["rc_rate"].as<int>(30)
         );
+        // Optional; feeds a capture through the sockets instead of flying
+        const std::string replay_file = config[type_id]["replay_file"].as<std::string>("");
+        if(!replay_file.empty()){
+          a->startReplay(replay_file, config[type_id]["replay_speed"].as<double>(1.0));
+        }
         m.insert(
           std::pair<std::string, std::unique_ptr<Tello>>(
             identifier,
@@ -0,0 +1,175 @@
+#include <algorithm>
+
+#include "decode_scheduler.hpp"
+#include "utils.hpp"
+
+DecodeScheduler::Lane::Lane(DecodeScheduler& scheduler, std::function<bool()> work, size_t home)
+  :
+  scheduler_(scheduler),
+  work_(std::move(work)),
+  home_(home)
+{}
+
+void DecodeScheduler::Lane::notify(){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if(closed_ || queued_) return;
+    if(running_){
+      // Run again by the worker running it once it returns
+      notified_ = true;
+      return;
+    }
+    queued_ = true;
+  }
+  scheduler_.schedule(shared_from_this(), home_);
+}
+
+void DecodeScheduler::Lane::close(){
+  std::unique_lock<std::mutex> lk(mutex_);
+  closed_ = true;
+  cv_.wait(lk, [this]{return !running_;});
+}
+
+void DecodeScheduler::Lane::run(size_t worker){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    queued_ = false;
+    if(closed_) return;
+    running_ = true;
+    notified_ = false;
+  }
+
+  bool more = false;
+  try {
+    more = work_();
+  }
+  catch (...) {
+    utils_log::LogErr() << "Decode lane threw an exception";
+  }
+
+  bool requeue = false;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    running_ = false;
+    if(!closed_ && (more || notified_)){
+      requeue = true;
+      queued_ = true;
+      notified_ = false;
+      // Stays with the worker that has its decoder state in cache
+      home_ = worker;
+    }
+  }
+  cv_.notify_all();
+  if(requeue) scheduler_.schedule(shared_from_this(), worker);
+}
+
+DecodeScheduler::DecodeScheduler(size_t n_workers){
+  if(n_workers == 0) n_workers = std::max(1u, std::thread::hardware_concurrency());
+  for(size_t i = 0; i < n_workers; ++i){
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Started once every worker exists as they steal from each other
+  for(size_t i = 0; i < n_workers; ++i){
+    workers_[i]->thread = std::thread(&DecodeScheduler::workerLoop, this, i);
+  }
+  utils_log::LogDebug() << "Decoding video on " << n_workers << " worker threads";
+}
+
+DecodeScheduler::~DecodeScheduler(){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    on_ = false;
+  }
+  cv_.notify_all();
+  for(auto& worker : workers_){
+    if(worker->thread.joinable()) worker->thread.join();
+  }
+}
+
+std::shared_ptr<DecodeScheduler> DecodeScheduler::shared(size_t n_workers){
+  static std::mutex mutex;
+  static std::weak_ptr<DecodeScheduler> instance;
+  std::lock_guard<std::mutex> lk(mutex);
+  std::shared_ptr<DecodeScheduler> scheduler = instance.lock();
+  if(!scheduler){
+    scheduler = std::make_shared<DecodeScheduler>(n_workers);
+    instance = scheduler;
+  }
+  return scheduler;
+}
+
+std::shared_ptr<DecodeScheduler::Lane> DecodeScheduler::addLane(std::function<bool()> work){
+  // Lanes start out spread over the workers
+  const size_t home = next_home_++ % workers_.size();
+  return std::shared_ptr<Lane>(new Lane(*this, std::move(work), home));
+}
+
+size_t DecodeScheduler::workers() const {
+  return workers_.size();
+}
+
+size_t DecodeScheduler::steals() const {
+  return steals_;
+}
+
+void DecodeScheduler::schedule(std::shared_ptr<Lane> lane, size_t worker){
+  {
+    std::lock_guard<std::mutex> lk(workers_[worker]->mutex);
+    workers_[worker]->lanes.push_back(std::move(lane));
+  }
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    queued_++;
+  }
+  cv_.notify_one();
+}
+
+bool DecodeScheduler::takeLane(size_t worker, std::shared_ptr<Lane>* lane){
+  {
+    Worker& own = *workers_[worker];
+    std::lock_guard<std::mutex> lk(own.mutex);
+    if(!own.lanes.empty()){
+      *lane = std::move(own.lanes.front());
+      own.lanes.pop_front();
+      return true;
+    }
+  }
+  // Steals the lane queued last, which is the least likely to be cache hot
+  for(size_t i = 1; i < workers_.size(); ++i){
+    Worker& victim = *workers_[(worker + i) % workers_.size()];
+    std::lock_guard<std::mutex> lk(victim.mutex);
+    if(!victim.lanes.empty()){
+      *lane = std::move(victim.lanes.back());
+      victim.lanes.pop_back();
+      steals_++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DecodeScheduler::workerLoop(size_t worker){
+  while(true){
+    {
+      std::unique_lock<std::mutex> lk(mutex_);
+      cv_.wait(lk, [this]{return queued_ > 0 || !on_;});
+      if(!on_) break;
+      // Every queued lane is claimed by exactly one worker
+      queued_--;
+    }
+    std::shared_ptr<Lane> lane;
+    if(takeLane(worker, &lane)){
+      lane->run(worker);
+      continue;
+    }
+    // The lane claimed was pushed to a deque already scanned while another
+    // worker took the one this worker would have found; it is still queued,
+    // so the claim is given back and the deques scanned again
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      queued_++;
+    }
+    std::this_thread::yield();
+  }
+  utils_log::LogDebug() << "----------- Decode worker " << worker << " exits -----------";
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+
+#include "frame_bus.hpp"
+#include "utils.hpp"
+
+FrameSubscription::FrameSubscription(const std::string& name, const FrameSpec& spec,
+  size_t queue_length, DropPolicy policy, bool on_request)
+  :
+  name_(name),
+  spec_(spec),
+  policy_(policy),
+  on_request_(on_request),
+  ring_(std::max<size_t>(1, queue_length))
+{}
+
+FrameSubscription::~FrameSubscription(){
+  close();
+}
+
+bool FrameSubscription::pop(VideoFrame& frame){
+  std::lock_guard<std::mutex> lk(mutex_);
+  if(size_ == 0) return false;
+  frame = std::move(ring_[head_]);
+  ring_[head_] = VideoFrame();
+  head_ = (head_ + 1) % ring_.size();
+  size_--;
+  return true;
+}
+
+bool FrameSubscription::wait(VideoFrame& frame){
+  std::unique_lock<std::mutex> lk(mutex_);
+  cv_.wait(lk, [this]{return size_ > 0 || closed_;});
+  if(size_ == 0) return false; // Closed and drained
+  frame = std::move(ring_[head_]);
+  ring_[head_] = VideoFrame();
+  head_ = (head_ + 1) % ring_.size();
+  size_--;
+  return true;
+}
+
+void FrameSubscription::request(int n_frames){
+  requested_ += n_frames;
+}
+
+bool FrameSubscription::active() const {
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if(closed_) return false;
+  }
+  return !on_request_ || requested_ > 0;
+}
+
+bool FrameSubscription::takeRequested(){
+  // A subscription closed without unsubscribing costs no conversion
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if(closed_) return false;
+  }
+  if(!on_request_) return true;
+  int requested = requested_.load();
+  while(requested > 0 && !requested_.compare_exchange_weak(requested, requested - 1)){}
+  return requested > 0;
+}
+
+void FrameSubscription::push(const VideoFrame& frame){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if(closed_) return;
+    if(size_ == ring_.size()){
+      dropped_++;
+      if(policy_ == DropPolicy::DropNewest) return;
+      head_ = (head_ + 1) % ring_.size();
+      size_--;
+    }
+    ring_[(head_ + size_) % ring_.size()] = frame;
+    size_++;
+  }
+  queued_++;
+  cv_.notify_one();
+}
+
+void FrameSubscription::startHandler(std::function<void(const VideoFrame&)> handler){
+  thread_ = std::thread([this, handler]{
+    VideoFrame frame;
+    while(wait(frame)){
+      handler(frame);
+      // Releases the image before waiting for the next one
+      frame = VideoFrame();
+    }
+    utils_log::LogDebug() << "----------- Frame subscriber " << name_ << " exits -----------";
+  });
+}
+
+void FrameSubscription::close(){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+  if(thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) thread_.join();
+}
+
+const std::string& FrameSubscription::name() const {
+  return name_;
+}
+
+const FrameSpec& FrameSubscription::spec() const {
+  return spec_;
+}
+
+size_t FrameSubscription::queued() const {
+  return queued_;
+}
+
+size_t FrameSubscription::dropped() const {
+  return dropped_;
+}
+
+FrameBus::FrameBus(ConverterBackend backend)
+  :
+  variants_(backend)
+{}
+
+FrameBus::~FrameBus(){
+  std::lock_guard<std::mutex> lk(mutex_);
+  for(auto& subscription : subscriptions_) subscription->close();
+  subscriptions_.clear();
+}
+
+std::shared_ptr<FrameSubscription> FrameBus::subscribe(const std::string& name, const FrameSpec& spec,
+  size_t queue_length, DropPolicy policy, bool on_request)
+{
+  auto subscription = std::make_shared<FrameSubscription>(name, spec, queue_length, policy, on_request);
+  std::lock_guard<std::mutex> lk(mutex_);
+  subscriptions_.push_back(subscription);
+  return subscription;
+}
+
+std::shared_ptr<FrameSubscription> FrameBus::subscribe(const std::string& name, const FrameSpec& spec,
+  std::function<void(const VideoFrame&)> handler, size_t queue_length, DropPolicy policy)
+{
+  auto subscription = std::make_shared<FrameSubscription>(name, spec, queue_length, policy, false);
+  subscription->startHandler(std::move(handler));
+  std::lock_guard<std::mutex> lk(mutex_);
+  subscriptions_.push_back(subscription);
+  return subscription;
+}
+
+void FrameBus::unsubscribe(const std::shared_ptr<FrameSubscription>& subscription){
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    subscriptions_.erase(std::remove(subscriptions_.begin(), subscriptions_.end(), subscription),
+      subscriptions_.end());
+  }
+  subscription->close();
+}
+
+uint64_t FrameBus::publish(const AVFrame& frame, std::chrono::steady_clock::time_point received){
+  const uint64_t id = next_id_++;
+  VideoFrame published;
+  published.id = id;
+  published.received = received;
+
+  // Converted without holding the lock, so subscribing and the stats are
+  // never held up by a conversion; a subscription closed meanwhile drops
+  // the frame. The copy reuses the capacity of the last one.
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    publishing_ = subscriptions_;
+  }
+  variants_.setFrame(frame);
+  for(auto& subscription : publishing_){
+    if(!subscription->takeRequested()) continue;
+    // Variants are only added by the publishing thread, as FrameVariants requires
+    if(subscription->variant_ == SIZE_MAX) subscription->variant_ = variants_.add(subscription->spec());
+    published.image = variants_.get(subscription->variant_);
+    subscription->push(published);
+  }
+  publishing_.clear();
+  published.image.release();
+  variants_.release();
+  allocations_ = variants_.allocations();
+  misses_ = variants_.misses();
+  return id;
+}
+
+bool FrameBus::active() const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  for(const auto& subscription : subscriptions_){
+    if(subscription->active()) return true;
+  }
+  return false;
+}
+
+size_t FrameBus::subscribers() const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return subscriptions_.size();
+}
+
+ConverterBackend FrameBus::backend() const {
+  return variants_.backend();
+}
+
+size_t FrameBus::allocations() const {
+  return allocations_;
+}
+
+size_t FrameBus::misses() const {
+  return misses_;
+}
@@ -0,0 +1,78 @@
+#include <opencv2/highgui.hpp>
+
+#include "frame_display.hpp"
+#include "utils.hpp"
+
+FrameDisplay::FrameDisplay(const std::string& window_name, std::shared_ptr<FrameSubscription> subscription,
+  std::mutex* gui_mutex)
+  :
+  window_name_(window_name),
+  subscription_(std::move(subscription)),
+  gui_mutex_(gui_mutex)
+{
+  // Started last as it uses the members above
+  thread_ = std::thread(&FrameDisplay::worker, this);
+}
+
+FrameDisplay::~FrameDisplay(){
+  subscription_->close();
+  if(thread_.joinable()) thread_.join();
+}
+
+void FrameDisplay::worker(){
+  // HighGUI windows have to be created, drawn and destroyed by one thread
+  cv::namedWindow(window_name_);
+  fps_start_ = std::chrono::steady_clock::now();
+
+  VideoFrame frame;
+  while(subscription_->wait(frame)){
+    show(frame.image, frame.received);
+    // Releases the frame's buffer before waiting for the next one
+    frame = VideoFrame();
+  }
+
+  cv::destroyWindow(window_name_);
+  utils_log::LogDebug() << "----------- Display thread exits -----------";
+}
+
+void FrameDisplay::show(const cv::Mat& image, std::chrono::steady_clock::time_point received){
+  if(gui_mutex_ != nullptr){
+    std::unique_lock<std::mutex> lk(*gui_mutex_);
+    cv::imshow(window_name_, image);
+    cv::waitKey(1);
+  }
+  else{
+    cv::imshow(window_name_, image);
+    cv::waitKey(1);
+  }
+  displayed_++;
+
+  const auto now = std::chrono::steady_clock::now();
+  if(received != std::chrono::steady_clock::time_point{}){
+    latency_.record(now - received);
+  }
+
+  fps_frames_++;
+  const double elapsed = std::chrono::duration<double>(now - fps_start_).count();
+  if(elapsed >= 1.0){
+    fps_ = fps_frames_ / elapsed;
+    fps_frames_ = 0;
+    fps_start_ = now;
+  }
+}
+
+size_t FrameDisplay::displayed() const {
+  return displayed_;
+}
+
+size_t FrameDisplay::skipped() const {
+  return subscription_->dropped();
+}
+
+double FrameDisplay::fps() const {
+  return fps_;
+}
+
+const LatencyHistogram& FrameDisplay::latency() const {
+  return latency_;
+}
@@ -0,0 +1,59 @@
+#include <stdexcept>
+
+#include "frame_pool.hpp"
+#include "utils.hpp"
+
+FramePool::FramePool(size_t max_buffers)
+  :
+  max_buffers_(max_buffers)
+{
+  buffers_.reserve(max_buffers_);
+}
+
+bool FramePool::isFree(const cv::Mat& buffer){
+  // The pool's own header is the only remaining reference. Read the way the
+  // subscriber threads release theirs, with an atomic add of zero, so their
+  // use of the pixels is over before the buffer is written again.
+  return buffer.u != nullptr && CV_XADD(&buffer.u->refcount, 0) == 1;
+}
+
+cv::Mat FramePool::allocate(int rows, int cols, int type, size_t min_bytes){
+  cv::Mat buffer(rows, cols, type);
+  if(buffer.total() * buffer.elemSize() < min_bytes){
+    throw std::length_error("Image buffer is smaller than required by the converter");
+  }
+  return buffer;
+}
+
+cv::Mat FramePool::acquire(int rows, int cols, int type, size_t min_bytes){
+  cv::Mat* reusable = nullptr;
+  for(auto& buffer : buffers_){
+    if(!isFree(buffer)) continue;
+    if(buffer.rows == rows && buffer.cols == cols && buffer.type() == type){
+      return buffer;
+    }
+    if(reusable == nullptr) reusable = &buffer;
+  }
+
+  allocations_++;
+  if(buffers_.size() < max_buffers_){
+    buffers_.push_back(allocate(rows, cols, type, min_bytes));
+    return buffers_.back();
+  }
+  if(reusable != nullptr){
+    // The frame size changed; replace a free buffer of the old size
+    *reusable = allocate(rows, cols, type, min_bytes);
+    return *reusable;
+  }
+  misses_++;
+  utils_log::LogDebug() << "Frame pool exhausted; allocating a buffer outside the pool";
+  return allocate(rows, cols, type, min_bytes);
+}
+
+size_t FramePool::allocations() const {
+  return allocations_;
+}
+
+size_t FramePool::misses() const {
+  return misses_;
+}
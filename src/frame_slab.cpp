@@ -0,0 +1,65 @@
+#include <cstring>
+
+#include "frame_slab.hpp"
+
+FrameSlab::FrameSlab(size_t capacity)
+  :
+  buffer_(capacity > 0 ? new unsigned char[capacity] : nullptr),
+  capacity_(capacity)
+{
+}
+
+FrameSlab::FrameSlab(FrameSlab&& other) noexcept
+  :
+  buffer_(std::move(other.buffer_)),
+  size_(other.size_),
+  capacity_(other.capacity_)
+{
+  other.size_ = 0;
+  other.capacity_ = 0;
+}
+
+FrameSlab& FrameSlab::operator=(FrameSlab&& other) noexcept {
+  buffer_ = std::move(other.buffer_);
+  size_ = other.size_;
+  capacity_ = other.capacity_;
+  other.size_ = 0;
+  other.capacity_ = 0;
+  return *this;
+}
+
+unsigned char* FrameSlab::reserveTail(size_t n){
+  if(size_ + n > capacity_){
+    size_t new_capacity = capacity_ > 0 ? capacity_ : n;
+    while(new_capacity < size_ + n) new_capacity *= 2;
+    std::unique_ptr<unsigned char[]> new_buffer(new unsigned char[new_capacity]);
+    if(size_ > 0) memcpy(new_buffer.get(), buffer_.get(), size_);
+    buffer_ = std::move(new_buffer);
+    capacity_ = new_capacity;
+  }
+  return buffer_.get() + size_;
+}
+
+void FrameSlab::commit(size_t n){
+  size_ += n;
+}
+
+void FrameSlab::clear(){
+  size_ = 0;
+}
+
+void FrameSlab::truncate(size_t n){
+  if(n < size_) size_ = n;
+}
+
+const unsigned char* FrameSlab::data() const {
+  return buffer_.get();
+}
+
+size_t FrameSlab::size() const {
+  return size_;
+}
+
+size_t FrameSlab::capacity() const {
+  return capacity_;
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "frame_variants.hpp"
+
+FrameVariants::FrameVariants(ConverterBackend backend)
+  :
+  bgr_converter_(backend)
+{}
+
+size_t FrameVariants::add(const FrameSpec& spec){
+  for(size_t i = 0; i < variants_.size(); ++i){
+    if(variants_[i].spec == spec) return i;
+  }
+  Variant variant;
+  variant.spec = spec;
+  variant.pool = std::make_unique<FramePool>();
+  variant.scaler = std::make_unique<ConverterScaled>();
+  variants_.push_back(std::move(variant));
+  return variants_.size() - 1;
+}
+
+void FrameVariants::setFrame(const AVFrame& frame){
+  release();
+  frame_ = &frame;
+}
+
+void FrameVariants::resolve(const FrameSpec& spec, const AVFrame& frame, int* width, int* height){
+  *width = spec.width;
+  *height = spec.height;
+  if(*width <= 0 && *height <= 0){
+    *width = frame.width;
+    *height = frame.height;
+  }
+  // Rounded to even sizes, which the scaler handles best for 4:2:0 input
+  else if(*width <= 0){
+    *width = std::max(2, (frame.width * *height / frame.height + 1) & ~1);
+  }
+  else if(*height <= 0){
+    *height = std::max(2, (frame.height * *width / frame.width + 1) & ~1);
+  }
+}
+
+cv::Mat FrameVariants::get(size_t index){
+  if(frame_ == nullptr) throw std::logic_error("No frame set to convert");
+  Variant& variant = variants_.at(index);
+  if(variant.converted) return variant.image;
+
+  const AVFrame& frame = *frame_;
+  int width = 0, height = 0;
+  resolve(variant.spec, frame, &width, &height);
+  const bool full_size = width == frame.width && height == frame.height;
+
+  // Specs that differ only in how they name the size, eg 0x0 and the frame's
+  // own size, share the image
+  for(const auto& other : variants_){
+    if(other.converted && other.image.cols == width && other.image.rows == height &&
+      other.spec.format == variant.spec.format){
+      variant.image = other.image;
+      variant.converted = true;
+      return variant.image;
+    }
+  }
+
+  if(variant.spec.format == OutputFormat::GRAY8){
+    variant.image = variant.pool->acquire(height, width, CV_8UC1,
+      ConverterScaled::predict_size(width, height, OutputFormat::GRAY8));
+    // The luma plane already is the grey image
+    if(full_size) gray_converter_.convert(frame, variant.image.data);
+    else variant.scaler->convert(frame, width, height, OutputFormat::GRAY8, variant.image.data);
+  }
+  else if(full_size){
+    variant.image = variant.pool->acquire(height, width, CV_8UC3,
+      bgr_converter_.predict_size(width, height));
+    bgr_converter_.convert(frame, variant.image.data);
+  }
+  else{
+    variant.image = variant.pool->acquire(height, width, CV_8UC3,
+      ConverterScaled::predict_size(width, height, OutputFormat::BGR24));
+    variant.scaler->convert(frame, width, height, OutputFormat::BGR24, variant.image.data);
+  }
+  variant.converted = true;
+  return variant.image;
+}
+
+void FrameVariants::release(){
+  frame_ = nullptr;
+  for(auto& variant : variants_){
+    variant.image.release();
+    variant.converted = false;
+  }
+}
+
+size_t FrameVariants::size() const {
+  return variants_.size();
+}
+
+ConverterBackend FrameVariants::backend() const {
+  return bgr_converter_.get_backend();
+}
+
+size_t FrameVariants::allocations() const {
+  size_t allocations = 0;
+  for(const auto& variant : variants_) allocations += variant.pool->allocations();
+  return allocations;
+}
+
+size_t FrameVariants::misses() const {
+  size_t misses = 0;
+  for(const auto& variant : variants_) misses += variant.pool->misses();
+  return misses;
+}
@@ -0,0 +1,93 @@
+#include <cstring>
+
+#include "h264_nal.hpp"
+#include "keyframe_cache.hpp"
+
+KeyframeCache::KeyframeCache(size_t max_bytes, size_t max_access_units)
+  :
+  max_bytes_(max_bytes),
+  max_access_units_(max_access_units)
+{
+  entries_.reserve(max_access_units_);
+}
+
+void KeyframeCache::add(const unsigned char* data, size_t size, int64_t pts, bool is_idr, bool intact){
+  if(!intact){
+    invalidate();
+    return;
+  }
+  const bool has_parameter_sets = keepParameterSets(data, size);
+  if(is_idr){
+    data_.clear();
+    entries_.clear();
+    valid_ = true;
+    keyframe_has_parameter_sets_ = has_parameter_sets;
+  }
+  if(!valid_) return;
+  if(entries_.size() >= max_access_units_ || data_.size() + size > max_bytes_){
+    // Decoding can only restart from the whole group of pictures
+    overflows_++;
+    invalidate();
+    return;
+  }
+  memcpy(data_.reserveTail(size), data, size);
+  data_.commit(size);
+  entries_.push_back(Entry{data_.size() - size, size, pts});
+}
+
+bool KeyframeCache::keepParameterSets(const unsigned char* data, size_t size){
+  // Parameter sets come before the first slice of an access unit, so the
+  // rest of it is not scanned
+  bool sps = false, pps = false;
+  size_t pos = h264_find_start_code(data, size, 0);
+  while(pos + 3 < size){
+    const int type = data[pos + 3] & 0x1f;
+    if(type == H264_NAL_SLICE || type == H264_NAL_IDR) break;
+    const size_t next = h264_find_start_code(data, size, pos + 3);
+    if(type == H264_NAL_SPS || type == H264_NAL_PPS){
+      // The zero byte of a four byte start code belongs to the next unit
+      size_t end = next;
+      while(end > pos + 4 && data[end - 1] == 0) end--;
+      std::vector<unsigned char>& set = type == H264_NAL_SPS ? sps_ : pps_;
+      set.assign({0, 0, 0, 1});
+      set.insert(set.end(), data + pos + 3, data + end);
+      (type == H264_NAL_SPS ? sps : pps) = true;
+    }
+    pos = next;
+  }
+  return sps && pps;
+}
+
+void KeyframeCache::invalidate(){
+  data_.clear();
+  entries_.clear();
+  valid_ = false;
+}
+
+bool KeyframeCache::valid() const {
+  return valid_ && !entries_.empty();
+}
+
+void KeyframeCache::forEach(const std::function<void(const unsigned char*, size_t, int64_t)>& f) const {
+  if(!valid()) return;
+  if(!keyframe_has_parameter_sets_ && !sps_.empty() && !pps_.empty()){
+    // Parsed into the packet of the keyframe that follows
+    f(sps_.data(), sps_.size(), entries_.front().pts);
+    f(pps_.data(), pps_.size(), entries_.front().pts);
+  }
+  for(const auto& entry : entries_){
+    f(data_.data() + entry.offset, entry.size, entry.pts);
+  }
+}
+
+size_t KeyframeCache::size() const {
+  return entries_.size();
+}
+
+size_t KeyframeCache::bytes() const {
+  return data_.size();
+}
+
+size_t KeyframeCache::overflows() const {
+  return overflows_;
+}
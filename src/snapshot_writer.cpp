@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "snapshot_writer.hpp"
+#include "utils.hpp"
+
+SnapshotWriter::SnapshotWriter(const std::string& directory, std::shared_ptr<FrameSubscription> subscription)
+  :
+  directory_(directory),
+  subscription_(std::move(subscription))
+{
+  // Started last as it uses the members above
+  thread_ = std::thread(&SnapshotWriter::worker, this);
+}
+
+SnapshotWriter::~SnapshotWriter(){
+  // The worker saves the frames still queued before it returns
+  subscription_->close();
+  if(thread_.joinable()) thread_.join();
+}
+
+void SnapshotWriter::take(int n_frames){
+  subscription_->request(n_frames);
+}
+
+void SnapshotWriter::worker(){
+  VideoFrame frame;
+  while(subscription_->wait(frame)){
+    // Encoding and writing happen on this thread, so the decoder never
+    // waits for the disk
+    const std::string file_name = nextFileName(frame);
+    if(cv::imwrite(file_name, frame.image)){
+      written_++;
+      utils_log::LogInfo() << "Picture taken. File " << file_name;
+    }
+    else{
+      utils_log::LogErr() << "Could not save picture " << file_name;
+    }
+    frame = VideoFrame();
+  }
+  utils_log::LogDebug() << "----------- Snapshot writer thread exits -----------";
+}
+
+std::string SnapshotWriter::nextFileName(const VideoFrame& frame){
+  // Stamped with the time the frame was received rather than saved, so the
+  // frames of a burst are apart by the frame interval however slow the disk
+  auto taken = std::chrono::system_clock::now();
+  if(frame.received != std::chrono::steady_clock::time_point{}){
+    taken -= std::chrono::duration_cast<std::chrono::system_clock::duration>(
+      std::chrono::steady_clock::now() - frame.received);
+  }
+  const time_t rawtime = std::chrono::system_clock::to_time_t(taken);
+  const long milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+    taken.time_since_epoch()).count() % 1000;
+
+  struct tm timeinfo;
+  localtime_r(&rawtime, &timeinfo);
+  char buffer [80];
+  const size_t n = strftime(buffer, 80, "tello_img_%Y_%m_%d_%H_%M_%S", &timeinfo);
+  snprintf(buffer + n, 80 - n, "_%03ld", milliseconds);
+
+  // Frames, eg of a replay, can be received within the same millisecond
+  std::string stamp(buffer);
+  if(stamp == last_stamp_){
+    same_stamp_count_++;
+  }
+  else{
+    last_stamp_ = stamp;
+    same_stamp_count_ = 0;
+  }
+  if(same_stamp_count_ > 0){
+    stamp += "_" + std::to_string(same_stamp_count_);
+  }
+  return directory_ + "/" + stamp + ".jpg";
+}
+
+size_t SnapshotWriter::written() const {
+  return written_;
+}
+
+size_t SnapshotWriter::dropped() const {
+  return subscription_->dropped();
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstring>
+
 #include "state_socket.hpp"
 #include "utils.hpp"
 
@@ -14,35 +17,49 @@ StateSocket::StateSocket(
   asio::ip::udp::resolver::iterator iter = resolver.resolve(query);
   endpoint_ = *iter;
 
+  receive();
+
+    io_thread = std::thread([&]{io_service_.run();});
+    io_thread.detach();
+
+}
+
+void StateSocket::receive()
+{
   socket_.async_receive_from(
     asio::buffer(data_, max_length_),
     endpoint_,
     [&](const std::error_code& error, size_t bytes_recvd)
     {return handleResponseFromDrone(error, bytes_recvd);});
     // [&](auto... args){return handleResponseFromDrone(args...);});
-
-    io_thread = std::thread([&]{io_service_.run();});
-    io_thread.detach();
-
 }
 
 void StateSocket::handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd)
 {
+  if(replaying_) return;
   if(!error && bytes_recvd>0){
-    response_ = std::string(data_);
-    std::replace(response_.begin(), response_.end(), ';', '\n');
-    // std::cout << "Status: \n" << response_ << std::endl;
+    capture(data_, bytes_recvd);
+    processResponse(bytes_recvd);
   }
   else{
     // utils_log::LogDebug() << "Error/Nothing received" ;
   }
 
-  socket_.async_receive_from(
-    asio::buffer(data_, max_length_),
-    endpoint_,
-    [&](const std::error_code& error, size_t bytes_recvd)
-    {return handleResponseFromDrone(error, bytes_recvd);});
-    // [&](auto... args){return handleResponseFromDrone(args...);});
+  receive();
+}
+
+void StateSocket::processInjectedDatagram(const unsigned char* data, size_t size)
+{
+  size = std::min<size_t>(size, max_length_);
+  memcpy(data_, data, size);
+  processResponse(size);
+}
+
+void StateSocket::processResponse(size_t bytes_recvd)
+{
+  response_ = std::string(data_, strnlen(data_, bytes_recvd));
+  std::replace(response_.begin(), response_.end(), ';', '\n');
+  // std::cout << "Status: \n" << response_ << std::endl;
 }
 
 StateSocket::~StateSocket(){
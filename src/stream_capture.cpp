@@ -0,0 +1,127 @@
+#include <cstring>
+
+#include "stream_capture.hpp"
+#include "utils.hpp"
+
+namespace {
+  const char magic[8] = {'T', 'E', 'L', 'L', 'O', 'C', 'A', 'P'};
+  const uint32_t version = 1;
+  enum{ header_size = 8 + 4 + 8 };
+  enum{ record_header_size = 8 + 1 + 4 };
+  // Larger than any datagram the drone sends; guards against corrupt files
+  enum{ max_payload_size = 1 << 16 };
+
+  void putLE(unsigned char* out, uint64_t value, int n_bytes){
+    for(int i = 0; i < n_bytes; ++i){
+      out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+  }
+
+  uint64_t getLE(const unsigned char* in, int n_bytes){
+    uint64_t value = 0;
+    for(int i = 0; i < n_bytes; ++i){
+      value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+  }
+}
+
+CaptureWriter::CaptureWriter(const std::string& file_name)
+  :
+  start_time_(std::chrono::steady_clock::now())
+{
+  file_ = std::fopen(file_name.c_str(), "wb");
+  if(file_ == nullptr){
+    utils_log::LogErr() << "Could not create capture file [" << file_name << "]. Not capturing.";
+    return;
+  }
+  const uint64_t wall_clock_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  unsigned char header[header_size];
+  memcpy(header, magic, sizeof(magic));
+  putLE(header + 8, version, 4);
+  putLE(header + 12, wall_clock_ns, 8);
+  std::fwrite(header, 1, header_size, file_);
+  utils_log::LogInfo() << "Capturing received datagrams to [" << file_name << "].";
+}
+
+CaptureWriter::~CaptureWriter(){
+  if(file_ != nullptr){
+    std::fclose(file_);
+    utils_log::LogInfo() << "Captured " << records_ << " datagrams.";
+  }
+}
+
+void CaptureWriter::write(CaptureStream stream, const unsigned char* data, size_t size){
+  if(file_ == nullptr) return;
+  const uint64_t timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start_time_).count();
+  unsigned char header[record_header_size];
+  putLE(header, timestamp_ns, 8);
+  header[8] = static_cast<unsigned char>(stream);
+  putLE(header + 9, size, 4);
+
+  // stdio buffers the writes; the lock keeps the records of the sockets apart
+  std::lock_guard<std::mutex> lk(mutex_);
+  std::fwrite(header, 1, record_header_size, file_);
+  std::fwrite(data, 1, size, file_);
+  records_++;
+}
+
+bool CaptureWriter::isOpen() const {
+  return file_ != nullptr;
+}
+
+size_t CaptureWriter::records() const {
+  return records_;
+}
+
+CaptureReader::CaptureReader(const std::string& file_name){
+  file_ = std::fopen(file_name.c_str(), "rb");
+  if(file_ == nullptr){
+    utils_log::LogErr() << "Could not open capture file [" << file_name << "].";
+    return;
+  }
+  unsigned char header[header_size];
+  if(std::fread(header, 1, header_size, file_) != header_size ||
+     memcmp(header, magic, sizeof(magic)) != 0 ||
+     getLE(header + 8, 4) != version){
+    utils_log::LogErr() << "[" << file_name << "] is not a capture file of a supported version.";
+    std::fclose(file_);
+    file_ = nullptr;
+    return;
+  }
+  start_time_ns_ = getLE(header + 12, 8);
+}
+
+CaptureReader::~CaptureReader(){
+  if(file_ != nullptr) std::fclose(file_);
+}
+
+bool CaptureReader::isOpen() const {
+  return file_ != nullptr;
+}
+
+bool CaptureReader::next(CaptureRecord& record){
+  if(file_ == nullptr) return false;
+  unsigned char header[record_header_size];
+  const size_t n = std::fread(header, 1, record_header_size, file_);
+  if(n == 0) return false;
+  const uint64_t size = getLE(header + 9, 4);
+  if(n != record_header_size || size > max_payload_size){
+    utils_log::LogWarn() << "Capture file ends with a truncated or corrupt record.";
+    return false;
+  }
+  record.timestamp_ns = getLE(header, 8);
+  record.stream = static_cast<CaptureStream>(header[8]);
+  record.payload.resize(size);
+  if(std::fread(record.payload.data(), 1, size, file_) != size){
+    utils_log::LogWarn() << "Capture file ends with a truncated or corrupt record.";
+    return false;
+  }
+  return true;
+}
+
+uint64_t CaptureReader::startTime() const {
+  return start_time_ns_;
+}
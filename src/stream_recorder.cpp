@@ -0,0 +1,163 @@
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "h264_nal.hpp"
+#include "stream_recorder.hpp"
+#include "utils.hpp"
+
+namespace {
+  // Receive times are converted to timestamps in microseconds
+  const AVRational receive_time_base{1, 1000000};
+  const uint8_t start_code[] = {0, 0, 0, 1};
+  enum{ max_nal_units = 64 };
+}
+
+StreamRecorder::StreamRecorder(const std::string& file_name)
+  :
+  file_name_(file_name)
+{
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+  av_register_all();
+#endif
+}
+
+StreamRecorder::~StreamRecorder(){
+  close();
+}
+
+bool StreamRecorder::open(const unsigned char* data, size_t size){
+  H264NalUnit units[max_nal_units];
+  const size_t n = std::min<size_t>(h264_split_nal_units(data, size, units, max_nal_units), max_nal_units);
+
+  const H264NalUnit* sps = nullptr;
+  const H264NalUnit* pps = nullptr;
+  bool idr = false;
+  for(size_t i = 0; i < n; ++i){
+    if(units[i].type == H264_NAL_SPS && sps == nullptr) sps = &units[i];
+    else if(units[i].type == H264_NAL_PPS && pps == nullptr) pps = &units[i];
+    else if(units[i].type == H264_NAL_IDR) idr = true;
+  }
+  if(sps == nullptr || pps == nullptr || !idr){
+    return false; // Wait for a keyframe
+  }
+
+  int width = 0, height = 0;
+  if(!h264_parse_sps_size(sps->data, sps->size, &width, &height)){
+    utils_log::LogErr() << "Could not read the frame size from the SPS. Not recording.";
+    failed_ = true;
+    return false;
+  }
+
+  avformat_alloc_output_context2(&format_context_, nullptr, nullptr, file_name_.c_str());
+  if(format_context_ == nullptr){
+    utils_log::LogErr() << "Could not create a container for [" << file_name_ << "]. Not recording.";
+    failed_ = true;
+    return false;
+  }
+
+  stream_ = avformat_new_stream(format_context_, nullptr);
+  packet_ = av_packet_alloc();
+  if(stream_ == nullptr || packet_ == nullptr){
+    utils_log::LogErr() << "Could not allocate the video stream. Not recording.";
+    failed_ = true;
+    close();
+    return false;
+  }
+
+  // SPS and PPS are passed in Annex-B form; the muxers convert them as required
+  const size_t extradata_size = 2 * sizeof(start_code) + sps->size + pps->size;
+  uint8_t* extradata = static_cast<uint8_t*>(av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE));
+  uint8_t* p = extradata;
+  memcpy(p, start_code, sizeof(start_code)); p += sizeof(start_code);
+  memcpy(p, sps->data, sps->size); p += sps->size;
+  memcpy(p, start_code, sizeof(start_code)); p += sizeof(start_code);
+  memcpy(p, pps->data, pps->size);
+
+  AVCodecParameters* par = stream_->codecpar;
+  par->codec_type = AVMEDIA_TYPE_VIDEO;
+  par->codec_id = AV_CODEC_ID_H264;
+  par->width = width;
+  par->height = height;
+  par->extradata = extradata;
+  par->extradata_size = static_cast<int>(extradata_size);
+  stream_->time_base = receive_time_base;
+
+  if(!(format_context_->oformat->flags & AVFMT_NOFILE) &&
+     avio_open(&format_context_->pb, file_name_.c_str(), AVIO_FLAG_WRITE) < 0){
+    utils_log::LogErr() << "Could not open [" << file_name_ << "] for writing. Not recording.";
+    failed_ = true;
+    close();
+    return false;
+  }
+  if(avformat_write_header(format_context_, nullptr) < 0){
+    utils_log::LogErr() << "Could not write the header of [" << file_name_ << "]. Not recording.";
+    failed_ = true;
+    close();
+    return false;
+  }
+
+  opened_ = true;
+  utils_log::LogInfo() << "Recording " << width << "x" << height << " H.264 stream to [" << file_name_ << "]";
+  return true;
+}
+
+void StreamRecorder::write(const unsigned char* data, size_t size, std::chrono::steady_clock::time_point received){
+  if(failed_ || size == 0) return;
+  if(!opened_){
+    if(!open(data, size)) return;
+    start_time_ = received;
+  }
+
+  int64_t pts = std::chrono::duration_cast<std::chrono::microseconds>(received - start_time_).count();
+  pts = av_rescale_q(pts, receive_time_base, stream_->time_base);
+  // The muxer requires strictly increasing timestamps
+  if(pts <= last_pts_) pts = last_pts_ + 1;
+  last_pts_ = pts;
+
+  H264NalUnit units[max_nal_units];
+  const size_t n = std::min<size_t>(h264_split_nal_units(data, size, units, max_nal_units), max_nal_units);
+  bool key = false;
+  for(size_t i = 0; i < n; ++i){
+    if(units[i].type == H264_NAL_IDR) key = true;
+  }
+
+  // Not reference counted; the muxer copies the data if it has to keep it
+  av_init_packet(packet_);
+  packet_->data = const_cast<uint8_t*>(data);
+  packet_->size = static_cast<int>(size);
+  packet_->stream_index = stream_->index;
+  packet_->pts = pts;
+  packet_->dts = pts;
+  packet_->flags = key ? AV_PKT_FLAG_KEY : 0;
+
+  if(av_interleaved_write_frame(format_context_, packet_) < 0){
+    utils_log::LogErr() << "Could not write to [" << file_name_ << "]. Recording stopped.";
+    failed_ = true;
+    close();
+    return;
+  }
+  frames_written_++;
+}
+
+size_t StreamRecorder::framesWritten() const {
+  return frames_written_;
+}
+
+void StreamRecorder::close(){
+  if(format_context_ != nullptr){
+    if(opened_ && !failed_) av_write_trailer(format_context_);
+    if(!(format_context_->oformat->flags & AVFMT_NOFILE)) avio_closep(&format_context_->pb);
+    avformat_free_context(format_context_);
+    format_context_ = nullptr;
+    stream_ = nullptr;
+  }
+  opened_ = false;
+  av_packet_free(&packet_);
+}
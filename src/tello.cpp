@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 
 #include "tello.hpp"
@@ -16,24 +17,56 @@ const std::string local_state_port,
 const std::string camera_config_file,
 const std::string vocabulary_file,
 const int n_retries,
-const int timeout,
+const double timeout,
 const std::string load_map_db_path,
 const std::string save_map_db_path,
 const std::string mask_img_path,
 bool load_map,
 bool continue_mapping,
 float scale,
-const std::string sequence_file
+const std::string sequence_file,
+const int decoder_threads,
+const H264ThreadType decoder_thread_type,
+const ConverterBackend converter_backend,
+const int snapshot_burst,
+const std::string capture_file,
+const bool request_keyframes,
+const int preview_width,
+const int preview_height,
+const int decode_workers,
+const FrameExportOptions& frame_export,
+const bool show_video,
+const int rc_rate
 ):
 io_service_(io_service),
-cv_run_(cv_run)
+cv_run_(cv_run),
+snapshot_burst_(snapshot_burst)
 {
-  cs = std::make_unique<CommandSocket>(io_service, drone_ip, "8889", local_drone_port, n_retries, timeout);
+  cs = std::make_unique<CommandSocket>(io_service, drone_ip, "8889", local_drone_port, n_retries,
+    std::chrono::milliseconds(static_cast<int64_t>(timeout * 1000)), rc_rate);
   vs = std::make_unique<VideoSocket>(io_service,  "0.0.0.0", "11111", local_video_port,
     run_, camera_config_file, vocabulary_file, load_map_db_path, save_map_db_path,
-    mask_img_path, load_map, continue_mapping, scale);
+    mask_img_path, load_map, continue_mapping, scale, decoder_threads,
+    decoder_thread_type, converter_backend,
+    FrameSpec{preview_width, preview_height, OutputFormat::BGR24},
+    static_cast<size_t>(std::max(0, decode_workers)),
+    frame_export,
+    show_video);
   ss = std::make_unique<StateSocket>(io_service, "0.0.0.0", "8890", local_state_port);
 
+  if(!capture_file.empty()){
+    auto capture = std::make_shared<CaptureWriter>(capture_file);
+    cs->setCapture(capture, CaptureStream::Command);
+    ss->setCapture(capture, CaptureStream::State);
+    vs->setCapture(capture, CaptureStream::Video);
+  }
+
+  if(request_keyframes){
+    // The drone starts the stream with a keyframe. Not sent while a command
+    // of the queue awaits its response, which the reply could be taken for
+    vs->setKeyframeRequest([this]{ return cs->sendCommandIfIdle(TelloCommand(CommandId::Streamon)); });
+  }
+
 #ifdef USE_JOYSTICK
   js_ = std::make_unique<Joystick>();
   js_thread_ = std::thread([&]{jsToCommandThread();});
@@ -159,34 +192,34 @@ void Tello::jsToCommand(ButtonId update){
     {
       case BUTTON_A:
         if(js_->getButtonState(BUTTON_LEFT_BUMPER_2)){
-          vs->setSnapshot();
+          vs->setSnapshot(snapshot_burst_);
         }
         else{
           cs->doNotAutoLand();
-          cs->sendCommand("takeoff");
+          cs->sendCommand(cmd::Takeoff{});
         }
         utils_log::LogDebug() << "Button [A]: [" << update << "] Value: [" << value <<"]";
         break;
       case BUTTON_B:
         cs->allowAutoLand();
         utils_log::LogDebug() << "Button [B]: [" << update << "] Value: [" << value <<"]";
-        cs->sendCommand("land");
+        cs->sendCommand(cmd::Land{});
         break;
       case BUTTON_X:
         if(js_->getButtonState(BUTTON_LEFT_BUMPER_2)){
-          cs->sendCommand("mon");
+          cs->sendCommand(TelloCommand(CommandId::Mon));
         }
         else{
-          cs->sendCommand("streamon");
+          cs->sendCommand(TelloCommand(CommandId::Streamon));
         }
         utils_log::LogDebug() << "Button [X]: [" << update << "] Value: [" << value <<"]";
         break;
       case BUTTON_Y:
         if(js_->getButtonState(BUTTON_LEFT_BUMPER_2)){
-          cs->sendCommand("moff");
+          cs->sendCommand(TelloCommand(CommandId::Moff));
         }
         else{
-          cs->sendCommand("streamoff");
+          cs->sendCommand(TelloCommand(CommandId::Streamoff));
         }
         utils_log::LogDebug() << "Button [Y]: [" << update << "] Value: [" << value <<"]";
         break;
@@ -228,7 +261,7 @@ void Tello::jsToCommand(ButtonId update){
           }
         }
         else{
-          cs->sendCommand("command");
+          cs->sendCommand(TelloCommand(CommandId::Command));
         }
         utils_log::LogDebug() << "Button [START]: [" << update << "] Value: [" << value <<"]";
         break;
@@ -257,26 +290,19 @@ void Tello::jsToCommand(ButtonId update){
 void Tello::jsToCommand(AxisId update){
   int16_t value = js_->getAxisState(update);
   utils_log::LogDebug() << "Axis: [" << update << "] Value: [" << js_->mapConstLimits(value) <<"]";
-  std::string cmd = "rc "
-  + std::to_string(js_->mapConstLimits(js_->getValueAxis(2))) + " "
-  + std::to_string(js_->mapConstLimits(js_->getValueAxis(3))*-1) + " "
-  + std::to_string(js_->mapConstLimits(js_->getValueAxis(1))*-1) + " "
-  + std::to_string(js_->mapConstLimits(js_->getValueAxis(0)));
   bool check = cs->isExecutingQueue();
   if(check) cs->stopQueueExecution();
   switch (update)
   {
     case AXIS_LEFT_STICK_HORIZONTAL:
-      cs->sendCommand(cmd);
-      break;
     case AXIS_LEFT_STICK_VERTICAL:
-      cs->sendCommand(cmd);
-      break;
     case AXIS_RIGHT_STICK_HORIZONTAL:
-      cs->sendCommand(cmd);
-      break;
     case AXIS_RIGHT_STICK_VERTICAL:
-      cs->sendCommand(cmd);
+      // Sent by the rc channel of the command socket at a fixed rate
+      cs->setRc(js_->mapConstLimits(js_->getValueAxis(2)),
+        js_->mapConstLimits(js_->getValueAxis(3))*-1,
+        js_->mapConstLimits(js_->getValueAxis(1))*-1,
+        js_->mapConstLimits(js_->getValueAxis(0)));
       break;
     case AXIS_RIGHT_BUMPER_2:
       break;
@@ -284,22 +310,22 @@ void Tello::jsToCommand(AxisId update){
       break;
     case AXIS_BUTTONS_HORIZONTAL:
       if(js_->getButtonState(BUTTON_LEFT_BUMPER_2) > 0){
-        if(value > 0) cs->sendCommand("speed?");
-        else if(value < 0) cs->sendCommand("battery?");
+        if(value > 0) cs->sendCommand(cmd::Query{CommandId::SpeedQuery});
+        else if(value < 0) cs->sendCommand(cmd::Query{CommandId::BatteryQuery});
       }
       else{
-        if(value > 0) cs->sendCommand("flip r");
-        else if(value < 0) cs->sendCommand("flip l");
+        if(value > 0) cs->sendCommand(cmd::Flip{FlipDirection::Right});
+        else if(value < 0) cs->sendCommand(cmd::Flip{FlipDirection::Left});
       }
       break;
     case AXIS_BUTTONS_VERTICAL:
       if(js_->getButtonState(BUTTON_LEFT_BUMPER_2)){
-        if(value > 0) cs->sendCommand("time?");
-        else if(value < 0) cs->sendCommand("wifi?");
+        if(value > 0) cs->sendCommand(cmd::Query{CommandId::TimeQuery});
+        else if(value < 0) cs->sendCommand(cmd::Query{CommandId::WifiQuery});
       }
       else{
-        if(value > 0) cs->sendCommand("flip b");
-        else if(value < 0) cs->sendCommand("flip f");
+        if(value > 0) cs->sendCommand(cmd::Flip{FlipDirection::Back});
+        else if(value < 0) cs->sendCommand(cmd::Flip{FlipDirection::Forward});
       }
       break;
     default:
@@ -325,7 +351,31 @@ void Tello::readSequence(const std::string& file){
 
 }
 
+size_t Tello::replayCapture(const std::string& file, double speed){
+  CaptureReplayer replayer(file);
+  replayer.addTarget(CaptureStream::Command, *cs);
+  replayer.addTarget(CaptureStream::State, *ss);
+  replayer.addTarget(CaptureStream::Video, *vs);
+  return replayer.run(speed);
+}
+
+void Tello::startReplay(const std::string& file, double speed){
+  if(replayer_){
+    utils_log::LogWarn() << "A replay was already started. Not replaying [" << file << "].";
+    return;
+  }
+  replayer_ = std::make_unique<CaptureReplayer>(file);
+  replayer_->addTarget(CaptureStream::Command, *cs);
+  replayer_->addTarget(CaptureStream::State, *ss);
+  replayer_->addTarget(CaptureStream::Video, *vs);
+  replay_thread_ = std::thread([this, speed]{ replayer_->run(speed); });
+}
+
 Tello::~Tello(){
   run_ = false;
+  if(replayer_){
+    replayer_->stop();
+    replay_thread_.join();
+  }
   usleep(1000000);
 }
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#include "tello_command.hpp"
+
+TelloCommand::TelloCommand(){}
+
+TelloCommand::TelloCommand(CommandId id)
+  :
+  id_(id)
+{
+  append(spec().word);
+}
+
+TelloCommand::TelloCommand(cmd::Takeoff) : TelloCommand(CommandId::Takeoff) {}
+
+TelloCommand::TelloCommand(cmd::Land) : TelloCommand(CommandId::Land) {}
+
+TelloCommand::TelloCommand(cmd::Stop) : TelloCommand(CommandId::Stop) {}
+
+TelloCommand::TelloCommand(cmd::Emergency) : TelloCommand(CommandId::Emergency) {}
+
+TelloCommand::TelloCommand(const cmd::Move& move)
+  :
+  TelloCommand(static_cast<CommandId>(static_cast<uint8_t>(CommandId::Up) + static_cast<uint8_t>(move.dir)))
+{
+  append(" ");
+  append(move.cm);
+}
+
+TelloCommand::TelloCommand(const cmd::Rotate& rotate)
+  :
+  TelloCommand(rotate.clockwise ? CommandId::Cw : CommandId::Ccw)
+{
+  append(" ");
+  append(rotate.degrees);
+}
+
+TelloCommand::TelloCommand(const cmd::Flip& flip)
+  :
+  TelloCommand(CommandId::Flip)
+{
+  const char dir[] = {' ', static_cast<char>(flip.dir), '\0'};
+  append(dir);
+}
+
+TelloCommand::TelloCommand(const cmd::Rc& rc)
+  :
+  TelloCommand(CommandId::Rc)
+{
+  for(int value : {rc.a, rc.b, rc.c, rc.d}){
+    append(" ");
+    append(std::max(-100, std::min(100, value)));
+  }
+}
+
+TelloCommand::TelloCommand(const cmd::Query& query)
+  :
+  TelloCommand(query.what)
+{}
+
+TelloCommand::TelloCommand(const cmd::Delay& delay)
+  :
+  TelloCommand(CommandId::Delay)
+{
+  char seconds[32];
+  snprintf(seconds, sizeof(seconds), " %g", delay.seconds);
+  append(seconds);
+}
+
+bool TelloCommand::parse(const std::string& text, TelloCommand& command){
+  const size_t begin = text.find_first_not_of(" \t\r\n");
+  if(begin == std::string::npos) return false;
+  const size_t end = text.find_last_not_of(" \t\r\n") + 1;
+  if(end - begin > max_size) return false;
+
+  const size_t word_end = std::min(text.find(' ', begin), end);
+  command = TelloCommand();
+  for(const CommandSpec& spec : command_table){
+    const size_t length = strlen(spec.word);
+    if(length > 0 && length == word_end - begin && text.compare(begin, length, spec.word) == 0){
+      command.id_ = spec.id;
+      break;
+    }
+  }
+  memcpy(command.data_, text.data() + begin, end - begin);
+  command.size_ = static_cast<uint8_t>(end - begin);
+  command.data_[command.size_] = '\0';
+  return true;
+}
+
+void TelloCommand::append(const char* text){
+  const size_t n = std::min(strlen(text), static_cast<size_t>(max_size) - size_);
+  memcpy(data_ + size_, text, n);
+  size_ += n;
+  data_[size_] = '\0';
+}
+
+void TelloCommand::append(int value){
+  const auto result = std::to_chars(data_ + size_, data_ + max_size, value);
+  if(result.ec == std::errc()) size_ = static_cast<uint8_t>(result.ptr - data_);
+  data_[size_] = '\0';
+}
@@ -1,16 +1,29 @@
+#include <algorithm>
+#include <cstring>
 #include <queue>
 #include <mutex>
 #include <iostream>
 
 #include <libavutil/frame.h>
-#include <opencv2/highgui.hpp>
-#include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 
+#include "h264_nal.hpp"
 #include "video_socket.hpp"
 #include "utils.hpp"
 
+namespace {
+  // Frames are tagged with the receive time of their first datagram
+  int64_t toPts(std::chrono::steady_clock::time_point time){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+  }
+
+  std::chrono::steady_clock::time_point fromPts(int64_t pts){
+    return std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(pts)));
+  }
+}
+
 VideoSocket::VideoSocket(
   asio::io_service& io_service,
   const std::string& drone_ip,
@@ -24,36 +37,43 @@ VideoSocket::VideoSocket(
   const std::string mask_img_path_,
   bool load_map_,
   bool continue_mapping,
-  float scale
+  float scale,
+  int decoder_threads,
+  H264ThreadType decoder_thread_type,
+  ConverterBackend converter_backend,
+  const FrameSpec& preview_spec,
+  size_t decode_workers,
+  const FrameExportOptions& frame_export,
+  bool show_video
 ):
   BaseSocket(io_service, drone_ip, drone_port, local_port),
+  access_unit_{FrameSlab(initial_frame_size_), {}, {}, false},
+  decode_queue_(decode_queue_length_),
+  recycle_queue_(decode_queue_length_),
+  keyframe_cache_(keyframe_cache_bytes_, keyframe_cache_access_units_),
+  decoder_(decoder_threads, decoder_thread_type),
+  bus_(converter_backend),
+  snapshot_writer_("../snapshots", bus_.subscribe("snapshot", FrameSpec(), snapshot_queue_length_,
+    DropPolicy::DropNewest, true)),
+  frame_export_(frame_export),
   run_(run)
 {
-  // cv::namedWindow("frame", CV_WINDOW_NORMAL);
-  // cv::moveWindow("frame",960,0);
-  // cv::resizeWindow("frame",920,500);
+  utils_log::LogDebug() << "Converting video frames with " << ConverterRGB24::backend_name(bus_.backend());
+  slab_allocations_++;
 
-  cv::namedWindow("Pilot view");
   asio::ip::udp::resolver resolver(io_service_);
   asio::ip::udp::resolver::query query(asio::ip::udp::v4(), drone_ip_, drone_port_);
   asio::ip::udp::resolver::iterator iter = resolver.resolve(query);
   endpoint_ = *iter;
 
-  socket_.async_receive_from(
-    asio::buffer(data_, max_length_),
-    endpoint_,
-    [&](const std::error_code& error, size_t bytes_recvd)
-    {return handleResponseFromDrone(error, bytes_recvd);});
-    // [&](auto... args){return handleResponseFromDrone(args...);});
-
-  io_thread = std::thread([&]{io_service_.run();
-    utils_log::LogDebug() << "----------- Video socket io_service thread exits -----------";
-  });
-  io_thread.detach();
-
 #ifdef RUN_SLAM
     api_ = std::make_unique<OpenVSLAM_API>(run_, camera_config_file, vocabulary_file, load_map_db_path_, save_map_db_path_, mask_img_path_, load_map_, continue_mapping, scale);
     api_->startMonoThread();
+    // The luma plane is copied once as the decoder reuses its buffers while
+    // SLAM works through its queue
+    slam_subscription_ = bus_.subscribe("slam", FrameSpec{0, 0, OutputFormat::GRAY8},
+      [this](const VideoFrame& frame){api_->addFrameToQueue(frame.image);},
+      slam_queue_length_, DropPolicy::DropOldest);
 #endif
 
 #ifdef RECORD
@@ -65,99 +85,569 @@ VideoSocket::VideoSocket(
   time (&rawtime);
   timeinfo = localtime (&rawtime);
   strftime (buffer,80,"../videos/tello_video_%Y_%m_%d_%H_%M_%S.mp4",timeinfo);
+#ifdef RECORD_REMUX
+  recorder_ = std::make_unique<StreamRecorder>(buffer);
+#else
   video = std::make_unique<cv::VideoWriter>(buffer, cv::VideoWriter::fourcc('m','p','4','v'), 30, cv::Size(960,720));
+  // Encoded on a thread of its own rather than by the decoder
+  record_subscription_ = bus_.subscribe("record", FrameSpec(),
+    [this](const VideoFrame& frame){video->write(frame.image);},
+    record_queue_length_, DropPolicy::DropOldest);
+#endif
 #endif
 
   std::string create_folder = "mkdir ../snapshots";
   system(create_folder.c_str());
-}
 
-void VideoSocket::handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd)
-{
-  if(first_empty_index == 0){
-    first_empty_index = 0;
-    frame_buffer_n_packets_ = 0;
+  if(show_video){
+#ifdef RUN_SLAM
+    // NOTE: In case there are some gdk/pangolin crashes
+    // 1. pass nullptr instead of the mutex and display only the frame displayed
+    //    with keypoints on L92 of pangolin_viewer/viewer.cc
+    // OR
+    // 2. Comment out L96-99 of pangolin_viewer/viewer.cc and amke install
+    //    OpenVSLAM
+    // and then rebuild the code
+    display_ = std::make_unique<FrameDisplay>("Pilot view",
+      bus_.subscribe("display", preview_spec, 1, DropPolicy::DropOldest), &api_->getMutex());
+#else
+    // Only the latest frame is kept for the display
+    display_ = std::make_unique<FrameDisplay>("Pilot view",
+      bus_.subscribe("display", preview_spec, 1, DropPolicy::DropOldest));
+#endif
   }
 
-  if (first_empty_index + bytes_recvd >= max_length_large_) {
-    utils_log::LogInfo() << "Frame buffer overflow. Dropping frame";
-    first_empty_index = 0;
-    frame_buffer_n_packets_ = 0;
-    return;
+  if(!frame_export_.shm_name.empty()){
+    // Out of process consumers read the frames in place; this is the only copy
+    shm_subscription_ = bus_.subscribe("shared memory", frame_export_.spec,
+      [this](const VideoFrame& frame){exportFrame(frame);},
+      1, DropPolicy::DropOldest);
   }
 
-  memcpy(frame_buffer_ + first_empty_index, data_, bytes_recvd );
-  first_empty_index += bytes_recvd;
-  frame_buffer_n_packets_++;
+  // Added last as the decode stage uses the SLAM api, the video writer and
+  // the display
+  scheduler_ = DecodeScheduler::shared(decode_workers);
+  decode_lane_ = scheduler_->addLane([this]{return decodePending();});
 
-  if (bytes_recvd < 1460) {
-    decodeFrame();
-    first_empty_index = 0;
-    frame_buffer_n_packets_ = 0;
-  }
+  // Receiving starts once the decode lane can be notified
+  receive();
+
+  io_thread = std::thread([&]{io_service_.run();
+    utils_log::LogDebug() << "----------- Video socket io_service thread exits -----------";
+  });
+  io_thread.detach();
+}
+
+unsigned char* VideoSocket::reserveDatagram()
+{
+  const size_t capacity = access_unit_.data.capacity();
+  unsigned char* tail = access_unit_.data.reserveTail(max_length_);
+  if(access_unit_.data.capacity() != capacity) slab_allocations_++;
+  return tail;
+}
+
+void VideoSocket::receive()
+{
+  unsigned char* tail = reserveDatagram();
 
   socket_.async_receive_from(
-    asio::buffer(data_, max_length_),
+    asio::buffer(tail, max_length_),
     endpoint_,
     [&](const std::error_code& error, size_t bytes_recvd)
     {return handleResponseFromDrone(error, bytes_recvd);});
     // [&](auto... args){return handleResponseFromDrone(args...);});
 }
 
-void VideoSocket::decodeFrame()
+void VideoSocket::handleResponseFromDrone(const std::error_code& error, size_t bytes_recvd)
 {
-  size_t next = 0;
-  try {
-    while (next < first_empty_index) {
-      ssize_t consumed = decoder_.parse((unsigned char*)&frame_buffer_ + next, first_empty_index - next);
+  if(replaying_) return;
+  if(!error){
+    capture(access_unit_.data.data() + access_unit_.data.size(), bytes_recvd);
+    assemble(bytes_recvd);
+  }
+
+  receive();
+}
 
-      if (decoder_.is_frame_available()) {
-        const AVFrame &frame = decoder_.decode_frame();
-        unsigned char bgr24[converter_.predict_size(frame.width, frame.height)];
-        converter_.convert(frame, bgr24);
+void VideoSocket::processInjectedDatagram(const unsigned char* data, size_t size)
+{
+  size = std::min<size_t>(size, max_length_);
+  memcpy(reserveDatagram(), data, size);
+  assemble(size);
+}
 
-        cv::Mat mat{frame.height, frame.width, CV_8UC3, bgr24};
+void VideoSocket::assemble(size_t bytes_recvd)
+{
+  packets_received_++;
+  const auto now = std::chrono::steady_clock::now();
+  if(frame_buffer_n_packets_ == 0) access_unit_.first_packet_time = now;
+  access_unit_.data.commit(bytes_recvd);
+  frame_buffer_n_packets_++;
 
-        if(snap_) takeSnapshot(mat);
+  // Queue every access unit whose end is marked by the start of the next one
+  // in this datagram; what follows the boundary starts the next access unit
+  size_t boundary;
+  while((boundary = findAccessUnitBoundary()) > 0){
+    queueFrame(boundary);
+    access_unit_.first_packet_time = now;
+    frame_buffer_n_packets_ = 1;
+  }
 
-#ifdef RECORD
-        video->write(mat.clone());
+  if (access_unit_.data.size() + max_length_ > max_frame_size_) {
+    utils_log::LogInfo() << "Frame larger than " << max_frame_size_ << " bytes. Dropping frame";
+    frames_dropped_overflow_++;
+    dropped_since_queued_ = true;
+    access_unit_.data.clear();
+    frame_buffer_n_packets_ = 0;
+    scan_pos_ = 0;
+    has_slice_ = false;
+  }
+  else if (bytes_recvd < max_payload_ && has_slice_) {
+    // The drone fills every datagram but the last of a frame, so a short one
+    // most likely ends the frame; queueing it now saves waiting for the
+    // start of the next frame
+    queueFrame(access_unit_.data.size());
+  }
+}
+
+size_t VideoSocket::findAccessUnitBoundary()
+{
+  const unsigned char* data = access_unit_.data.data();
+  const size_t size = access_unit_.data.size();
+  while(true){
+    const size_t pos = h264_find_start_code(data, size, scan_pos_);
+    // The NAL header and, for slices, the first byte of the slice header are
+    // needed; a start code split across datagrams is found again next time
+    if(pos + 4 >= size){
+      scan_pos_ = pos < size ? pos : (size > 2 ? size - 2 : 0);
+      return 0;
+    }
+    const int type = data[pos + 3] & 0x1f;
+    const bool is_slice = type == H264_NAL_SLICE || type == H264_NAL_IDR;
+    bool starts_access_unit = false;
+    if(is_slice){
+      // first_mb_in_slice is 0, ie the ue(v) code is the single bit 1, only
+      // for the first slice of a picture
+      starts_access_unit = has_slice_ && (data[pos + 4] & 0x80);
+    }
+    else if(type == H264_NAL_AUD || type == H264_NAL_SPS || type == H264_NAL_PPS || type == H264_NAL_SEI){
+      starts_access_unit = has_slice_;
+    }
+    if(starts_access_unit){
+      // The zero byte of a four byte start code belongs to the next unit
+      return pos > 0 && data[pos - 1] == 0 ? pos - 1 : pos;
+    }
+    if(is_slice) has_slice_ = true;
+    scan_pos_ = pos + 3;
+  }
+}
+
+void VideoSocket::queueFrame(size_t end)
+{
+  frames_assembled_++;
+  if(end < access_unit_.data.size()) frames_split_on_start_code_++;
+  access_unit_.last_packet_time = std::chrono::steady_clock::now();
+
+  FrameSlab next;
+  if(!recycle_queue_.tryPop(next)){
+    next = FrameSlab(initial_frame_size_);
+    slab_allocations_++;
+  }
+  // Bytes past the end already belong to the next access unit
+  const size_t tail_size = access_unit_.data.size() - end;
+  if(tail_size > 0){
+    const size_t capacity = next.capacity();
+    memcpy(next.reserveTail(tail_size), access_unit_.data.data() + end, tail_size);
+    if(next.capacity() != capacity) slab_allocations_++;
+    next.commit(tail_size);
+    access_unit_.data.truncate(end);
+  }
+
+  // The decoder has to know; the frames after a dropped one cannot be decoded
+  access_unit_.follows_gap = dropped_since_queued_;
+  if(decode_queue_.tryPush(std::move(access_unit_))){
+    const size_t depth = decode_queue_.size();
+    if(depth > decode_queue_max_depth_) decode_queue_max_depth_ = depth;
+    decode_lane_->notify();
+    dropped_since_queued_ = false;
+  }
+  else{
+    // Never wait for the decoder here; the socket has to be drained
+    frames_dropped_queue_full_++;
+    dropped_since_queued_ = true;
+  }
+  access_unit_.data = std::move(next);
+  access_unit_.follows_gap = false;
+  frame_buffer_n_packets_ = 0;
+  scan_pos_ = 0;
+  has_slice_ = false;
+}
+
+bool VideoSocket::decodePending()
+{
+  // Run by whichever worker of the scheduler picks up the lane, one at a time
+  AccessUnit access_unit;
+  for(int i = 0; i < decode_batch_; ++i){
+    if(!decode_queue_.tryPop(access_unit)) return false;
+#ifdef RECORD_REMUX
+    recorder_->write(access_unit.data.data(), access_unit.data.size(), access_unit.first_packet_time);
 #endif
+    const unsigned char* data = access_unit.data.data();
+    const size_t size = access_unit.data.size();
+    bool is_idr = false;
+    // The receive stage dropped access units before this one unchecked, so
+    // the frame_num of the last reference picture says nothing about it
+    if(access_unit.follows_gap) gap_detector_.reset();
+    const bool intact = gap_detector_.check(data, size, &is_idr) && !access_unit.follows_gap;
+    // Nothing is decoded while no subscriber needs pixels
+    if(!bus_.active()) idle();
+    else if(checkAccessUnit(intact, is_idr)) decodeFrame(access_unit);
+    // Cached after decoding, so priming only replays the access units before
+    // the one being decoded
+    keyframe_cache_.add(data, size, toPts(access_unit.first_packet_time), is_idr, intact);
+    keyframe_cache_overflows_ = keyframe_cache_.overflows();
+    // If the receive stage already holds enough spare slabs this one is freed
+    recycle_queue_.tryPush(std::move(access_unit.data));
+  }
+  // Lets the other drones have a turn before the rest of the queue
+  return !decode_queue_.empty();
+}
 
-#ifdef RUN_SLAM
-        cv::Mat greyMat;
-        cv::cvtColor(mat, greyMat, cv::COLOR_BGR2GRAY);
-        api_->addFrameToQueue(greyMat);
-        // NOTE: In case there are some gdk/pangolin crashes
-        // 1. comment out the 3 lines below and display only the frame displayed
-        //    with keypoints on L92 of pangolin_viewer/viewer.cc
-        // OR
-        // 2. Comment out L96-99 of pangolin_viewer/viewer.cc and amke install
-        //    OpenVSLAM
-        // and then rebuild the code
-        {
-          std::unique_lock<std::mutex> lk(api_->getMutex());
-          cv::imshow("Pilot view", mat.clone());
-          cv::waitKey(1);
+void VideoSocket::decodeFrame(const AccessUnit& access_unit)
+{
+  const auto dequeued = std::chrono::steady_clock::now();
+  latency(VideoStage::Reassembly).record(access_unit.last_packet_time - access_unit.first_packet_time);
+  latency(VideoStage::DecodeQueue).record(dequeued - access_unit.last_packet_time);
+  const int64_t pts = toPts(access_unit.first_packet_time);
+  timings_[next_timing_++ % timings_.size()] = AccessUnitTiming{pts, dequeued, {}};
+
+  try {
+    feedDecoder(access_unit.data.data(), access_unit.data.size(), pts);
+  }
+  catch (...) {
+    decode_errors_++;
+    utils_log::LogErr() << "Error in decoding frame";
+    waitForIdr();
+  }
+}
+
+void VideoSocket::feedDecoder(const unsigned char* data, size_t size, int64_t pts)
+{
+  size_t next = 0;
+  while (next < size && !waiting_for_idr_) {
+    ssize_t consumed = decoder_.parse(data + next, size - next, pts);
+
+    if (decoder_.is_frame_available()) {
+      // A packet can yield no frame (frame threading still filling up) or
+      // several; the decoder only refuses a packet while frames are pending
+      bool sent = decoder_.send_packet();
+      if (sent) packetSent(decoder_.packet_pts());
+      while (const AVFrame* frame = decoder_.receive_frame()) {
+        processFrame(*frame);
+      }
+      // processFrame may have reset the decoder, which empties the packet; an
+      // empty packet would put the decoder into drain mode
+      if (waiting_for_idr_) break;
+      if (!sent && decoder_.send_packet()) {
+        packetSent(decoder_.packet_pts());
+        while (const AVFrame* frame = decoder_.receive_frame()) {
+          processFrame(*frame);
         }
-#else
-        cv::imshow("Pilot view", mat.clone());
-        cv::waitKey(1);
-#endif
       }
-      next += consumed;
+    }
+    next += consumed;
+  }
+}
+
+bool VideoSocket::checkAccessUnit(bool intact, bool is_idr)
+{
+  if(!intact) waitForIdr();
+
+  if(waiting_for_idr_){
+    if(intact && is_idr){
+      waiting_for_idr_ = false;
+      utils_log::LogInfo() << "Resuming decoding at a keyframe. " << frames_discarded_ << " frames discarded so far.";
+      return true;
+    }
+    // Nothing was lost since the cached keyframe, eg decoding was paused or
+    // the decoder failed, so decoding need not wait for the next one
+    if(intact && primeDecoder()) return true;
+    // Frames that depend on lost data are discarded rather than decoded into
+    // smeared pictures
+    frames_discarded_++;
+    requestKeyframe();
+    return false;
+  }
+  return true;
+}
+
+bool VideoSocket::primeDecoder()
+{
+  if(!keyframe_cache_.valid()) return false;
+  const auto start = std::chrono::steady_clock::now();
+  waiting_for_idr_ = false;
+  priming_ = true;
+  try {
+    decoder_.reset();
+    keyframe_cache_.forEach([this](const unsigned char* data, size_t size, int64_t pts){
+      feedDecoder(data, size, pts);
+      primed_pts_ = pts;
+    });
+    // The parser holds the last access unit until the next one starts, and
+    // its frames would be published once priming is over
+    if(!waiting_for_idr_){
+      decoder_.parse(nullptr, 0, AV_NOPTS_VALUE);
+      if(decoder_.is_frame_available() && decoder_.send_packet()) packetSent(decoder_.packet_pts());
+      while (const AVFrame* frame = decoder_.receive_frame()) {
+        processFrame(*frame);
+      }
     }
   }
   catch (...) {
-    utils_log::LogErr() << "Error in decoding frame";
+    decode_errors_++;
+    waiting_for_idr_ = true;
+  }
+  priming_ = false;
+
+  if(waiting_for_idr_){
+    // The cached data does not decode either; only the next keyframe helps
+    utils_log::LogWarn() << "Could not restart decoding from the cached keyframe.";
+    keyframe_cache_.invalidate();
+    try {
+      decoder_.reset();
+    }
+    catch (...) {
+      utils_log::LogErr() << "Could not reset the decoder";
+    }
+    return false;
+  }
+  decoder_primes_++;
+  utils_log::LogInfo() << "Resuming decoding from the cached keyframe, " << keyframe_cache_.size()
+    << " frames back, in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count() << " ms.";
+  return true;
+}
+
+void VideoSocket::idle()
+{
+  frames_skipped_idle_++;
+  if(waiting_for_idr_) return;
+  // The frames skipped leave the decoder without references; decoding
+  // resumes from the cached keyframe once a subscriber needs pixels again
+  waiting_for_idr_ = true;
+  utils_log::LogDebug() << "No subscriber needs pixels. Decoding paused.";
+  try {
+    decoder_.reset();
+  }
+  catch (...) {
+    utils_log::LogErr() << "Could not reset the decoder";
+  }
+}
+
+void VideoSocket::waitForIdr()
+{
+  if(waiting_for_idr_) return;
+  waiting_for_idr_ = true;
+  // A failure while priming is handled by primeDecoder
+  if(priming_) return;
+  decode_gaps_++;
+  utils_log::LogWarn() << "Video data lost. Discarding frames until the next keyframe.";
+  try {
+    decoder_.reset();
+  }
+  catch (...) {
+    utils_log::LogErr() << "Could not reset the decoder";
+  }
+}
+
+void VideoSocket::requestKeyframe()
+{
+  const auto now = std::chrono::steady_clock::now();
+  if(now - last_keyframe_request_ < std::chrono::milliseconds(keyframe_request_interval_ms_)) return;
+  std::function<bool()> request;
+  {
+    std::lock_guard<std::mutex> lk(keyframe_request_mutex_);
+    request = keyframe_request_;
+  }
+  if(!request || !request()) return;
+  last_keyframe_request_ = now;
+  keyframe_requests_++;
+}
+
+void VideoSocket::setKeyframeRequest(std::function<bool()> request)
+{
+  std::lock_guard<std::mutex> lk(keyframe_request_mutex_);
+  keyframe_request_ = std::move(request);
+}
+
+VideoSocket::AccessUnitTiming* VideoSocket::findTiming(int64_t pts)
+{
+  if(pts == AV_NOPTS_VALUE) return nullptr;
+  for(auto& timing : timings_){
+    if(timing.pts == pts) return &timing;
+  }
+  return nullptr;
+}
+
+void VideoSocket::packetSent(int64_t pts)
+{
+  // Replayed access units were measured when they were first decoded
+  if(priming_) return;
+  AccessUnitTiming* timing = findTiming(pts);
+  if(timing == nullptr) return;
+  timing->sent = std::chrono::steady_clock::now();
+  latency(VideoStage::Parse).record(timing->sent - timing->dequeued);
+}
+
+void VideoSocket::processFrame(const AVFrame& frame)
+{
+  // Frames replayed from the keyframe cache only bring the decoder up to the
+  // current picture; with frame threading some come out after priming
+  const bool primed = priming_ || (frame.pts != AV_NOPTS_VALUE && primed_pts_ != AV_NOPTS_VALUE && frame.pts <= primed_pts_);
+  if(primed) frames_primed_++;
+  else frames_decoded_++;
+  if(frame.decode_error_flags != 0){
+    // Concealed errors; the following frames would build on them
+    if(!primed) frames_discarded_++;
+    waitForIdr();
+    return;
+  }
+  if(primed) return;
+  const auto decoded = std::chrono::steady_clock::now();
+  const AccessUnitTiming* timing = findTiming(frame.pts);
+  if(timing != nullptr && timing->sent != std::chrono::steady_clock::time_point{}){
+    latency(VideoStage::Decode).record(decoded - timing->sent);
+  }
+  const auto received = timing != nullptr ? fromPts(frame.pts) : std::chrono::steady_clock::time_point{};
+
+  // Every subscriber gets the image it asked for, converted once per spec
+  // and shared rather than copied; queueing never waits for a subscriber
+  bus_.publish(frame, received);
+  latency(VideoStage::Convert).record(std::chrono::steady_clock::now() - decoded);
+
+  if(received != std::chrono::steady_clock::time_point{}){
+    latency(VideoStage::Handoff).record(std::chrono::steady_clock::now() - received);
+  }
+}
+
+VideoPipelineStats VideoSocket::getPipelineStats() const
+{
+  VideoPipelineStats stats;
+  stats.packets_received = packets_received_;
+  stats.frames_assembled = frames_assembled_;
+  stats.frames_dropped_overflow = frames_dropped_overflow_;
+  stats.frames_split_on_start_code = frames_split_on_start_code_;
+  stats.slab_allocations = slab_allocations_;
+  stats.decode_queue_depth = decode_queue_.size();
+  stats.decode_queue_max_depth = decode_queue_max_depth_;
+  stats.frames_dropped_queue_full = frames_dropped_queue_full_;
+  stats.frames_decoded = frames_decoded_;
+  stats.decode_errors = decode_errors_;
+  stats.frames_discarded = frames_discarded_;
+  stats.decode_gaps = decode_gaps_;
+  stats.keyframe_requests = keyframe_requests_;
+  stats.decode_workers = scheduler_->workers();
+  stats.decode_steals = scheduler_->steals();
+  stats.frame_allocations = bus_.allocations();
+  stats.frame_pool_misses = bus_.misses();
+  stats.frame_subscribers = bus_.subscribers();
+  stats.snapshots_written = snapshot_writer_.written();
+  stats.snapshots_dropped = snapshot_writer_.dropped();
+  stats.frames_skipped_idle = frames_skipped_idle_;
+  stats.decoder_primes = decoder_primes_;
+  stats.frames_primed = frames_primed_;
+  stats.keyframe_cache_overflows = keyframe_cache_overflows_;
+  if(display_){
+    stats.frames_displayed = display_->displayed();
+    stats.frames_display_skipped = display_->skipped();
+    stats.display_fps = display_->fps();
   }
+  return stats;
+}
+
+const LatencyHistogram& VideoSocket::latency(VideoStage stage) const
+{
+  return latency_[static_cast<size_t>(stage)];
+}
+
+LatencyHistogram& VideoSocket::latency(VideoStage stage)
+{
+  return latency_[static_cast<size_t>(stage)];
+}
+
+LatencyHistogram::Summary VideoSocket::getLatency(VideoStage stage) const
+{
+  if(stage == VideoStage::Display){
+    return display_ ? display_->latency().summary() : LatencyHistogram::Summary();
+  }
+  return latency(stage).summary();
+}
+
+const char* VideoSocket::stageName(VideoStage stage)
+{
+  switch(stage){
+    case VideoStage::Reassembly: return "reassembly";
+    case VideoStage::DecodeQueue: return "decode queue";
+    case VideoStage::Parse: return "parse";
+    case VideoStage::Decode: return "decode";
+    case VideoStage::Convert: return "convert";
+    case VideoStage::Handoff: return "first packet to handoff";
+    case VideoStage::Display: return "first packet to display";
+  }
+  return "";
 }
 
 VideoSocket::~VideoSocket(){
-#ifdef RECORD
+  // Waits for a worker decoding a frame of this drone
+  decode_lane_->close();
+
+  const VideoPipelineStats stats = getPipelineStats();
+  utils_log::LogInfo() << "Video pipeline: received " << stats.packets_received
+    << " packets, assembled " << stats.frames_assembled << " frames, decoded "
+    << stats.frames_decoded << " frames on " << stats.decode_workers
+    << " shared workers (" << stats.frames_split_on_start_code
+    << " split at a start code) using " << stats.slab_allocations
+    << " slab allocations. Dropped " << stats.frames_dropped_overflow
+    << " on overflow and " << stats.frames_dropped_queue_full
+    << " with the decode queue full (max depth " << stats.decode_queue_max_depth
+    << "). " << stats.decode_errors << " decode errors, "
+    << stats.decode_gaps << " gaps, " << stats.frames_discarded
+    << " frames discarded waiting for a keyframe, " << stats.keyframe_requests
+    << " keyframes requested, " << stats.frames_skipped_idle
+    << " not decoded as no subscriber needed pixels, " << stats.decoder_primes
+    << " restarts from the cached keyframe (" << stats.frames_primed << " frames decoded again, "
+    << stats.keyframe_cache_overflows << " cache overflows). "
+    << stats.frame_allocations << " image buffers allocated, "
+    << stats.frame_pool_misses << " outside the pool. "
+    << stats.snapshots_written << " snapshots saved, "
+    << stats.snapshots_dropped << " dropped. Displayed "
+    << stats.frames_displayed << " frames, skipped "
+    << stats.frames_display_skipped << ".";
+  for(auto stage : {VideoStage::Reassembly, VideoStage::DecodeQueue, VideoStage::Parse,
+      VideoStage::Decode, VideoStage::Convert, VideoStage::Handoff}){
+    utils_log::LogInfo() << "Latency " << stageName(stage) << ": " << latency(stage).toString();
+  }
+  if(display_){
+    utils_log::LogInfo() << "Latency " << stageName(VideoStage::Display) << ": " << display_->latency().toString();
+  }
+
+#ifdef RUN_SLAM
+  bus_.unsubscribe(slam_subscription_);
+#endif
+  if(shm_subscription_) bus_.unsubscribe(shm_subscription_);
+  if(shm_frames_too_large_ > 0){
+    utils_log::LogWarn() << shm_frames_too_large_ << " frames did not fit in the shared memory slots.";
+  }
+  shm_writer_.reset();
+#ifdef RECORD_REMUX
+  utils_log::LogInfo() << "Recorded " << recorder_->framesWritten() << " frames.";
+  recorder_.reset();
+#elif defined(RECORD)
+  // Encodes the frames still queued first
+  bus_.unsubscribe(record_subscription_);
   video->release();
 #endif
-  cv::destroyAllWindows();
+  display_.reset();
   socket_.close();
 }
 
@@ -166,19 +656,44 @@ void VideoSocket::handleSendCommand(const std::error_code& error, size_t bytes_s
   utils_log::LogErr() << "VideoSocket class does not implement handleSendCommand()";
 }
 
-void VideoSocket::takeSnapshot(cv::Mat& image){
-  snap_ = false;
+void VideoSocket::setSnapshot(int n_frames){
+  snapshot_writer_.take(n_frames);
+}
 
-  time_t rawtime;
-  struct tm * timeinfo;
-  char buffer [80];
-  time (&rawtime);
-  timeinfo = localtime (&rawtime);
-  strftime (buffer,80,"../snapshots/tello_img_%Y_%m_%d_%H_%M_%S.jpg",timeinfo);
-  cv::imwrite(std::string(buffer), image);
-  utils_log::LogInfo() << "Picture taken. File " << buffer;
+void VideoSocket::exportFrame(const VideoFrame& frame)
+{
+  const FrameSpec& shm_spec = frame_export_.spec;
+  const size_t bytes = frame.image.step[0] * frame.image.rows;
+  if(!shm_writer_){
+    // Sized by the spec; a size following the decoded frame may grow up to
+    // the largest frame of the drone, and rows may be padded
+    const size_t width = shm_spec.width > 0 ? shm_spec.width : std::max<int>(shm_max_width_, frame.image.cols);
+    const size_t height = shm_spec.height > 0 ? shm_spec.height : std::max<int>(shm_max_height_, frame.image.rows);
+    const size_t slot_bytes = std::max(bytes, width * height * ConverterScaled::bytes_per_pixel(shm_spec.format));
+    try {
+      shm_writer_ = std::make_unique<FrameShmWriter>(frame_export_.shm_name, shm_slots_, slot_bytes);
+      utils_log::LogInfo() << "Exporting frames to shared memory " << frame_export_.shm_name;
+    }
+    catch (const std::exception& e) {
+      utils_log::LogErr() << e.what() << ". Not exporting frames.";
+      bus_.unsubscribe(shm_subscription_);
+      return;
+    }
+  }
+  const int64_t received_ns = frame.received == std::chrono::steady_clock::time_point{} ? 0 :
+    toPts(frame.received);
+  const FrameShmFormat format = frame.image.channels() == 1 ? FrameShmFormat::GRAY8 : FrameShmFormat::BGR24;
+  if(!shm_writer_->write(frame.id, received_ns, frame.image.cols, frame.image.rows,
+      static_cast<uint32_t>(frame.image.step[0]), format, frame.image.data)){
+    // Logged once; the frames that follow are most likely as large
+    if(shm_frames_too_large_++ == 0){
+      utils_log::LogWarn() << "Frame of " << bytes << " bytes does not fit in the shared memory slots of "
+        << shm_writer_->slotBytes() << " bytes; such frames are not exported";
+    }
+  }
 }
 
-void VideoSocket::setSnapshot(){
-  snap_ = true;
+FrameBus& VideoSocket::getFrameBus()
+{
+  return bus_;
 }